@@ -0,0 +1,459 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "posint.h"
+using namespace std;
+
+/* Benchmark suite for the PosInt class.
+ *
+ * Every (operation, base, size) case is timed with a monotonic clock.
+ * Each sample runs the operation enough times to last at least
+ * --sample-time seconds, so the clock resolution never dominates, and
+ * samples are collected after a warm-up until the 95% confidence
+ * interval of the mean is within --precision of the mean (or the
+ * per-case time limit runs out). Results can be written as CSV/JSON,
+ * and compared against a CSV baseline from an earlier run; any case
+ * whose median got slower than the tolerance makes the program fail.
+ */
+
+typedef chrono::steady_clock Clock;
+
+/******************** OPERATIONS ********************/
+
+// The inputs and outputs of a single benchmark case.
+struct Operands {
+  PosInt x, y, q, r;
+  string text;
+};
+
+// Each benchmarked operation leaves x and y unchanged, so it can be
+// repeated any number of times on the same operands. The in-place
+// operations therefore include the cost of copying x into r.
+static void benchAdd (Operands& o) { o.r.set(o.x); o.r.add(o.y); }
+static void benchSub (Operands& o) { o.r.set(o.x); o.r.sub(o.y); }
+static void benchMul (Operands& o) { o.r.set(o.x); o.r.mul(o.y); }
+static void benchFastMul (Operands& o) { o.r.set(o.x); o.r.fastMul(o.y); }
+static void benchAddmul (Operands& o) { o.r.set(o.x); o.r.addmul(o.x, o.y); }
+static void benchDivrem (Operands& o) { PosInt::divrem(o.q, o.r, o.x, o.y); }
+static void benchPow (Operands& o) { o.r.set(o.x); o.r.pow(o.y); }
+static void benchGcd (Operands& o) { o.r.gcd(o.x, o.y); }
+static void benchPrint (Operands& o) { ostringstream out; o.x.print(out); }
+static void benchRead (Operands& o) { o.r.read(o.text.c_str()); }
+
+// How the operands of a case are shaped, relative to the size n.
+enum Shape {
+  SAME,     // x and y both have n digits
+  ORDERED,  // x and y both have n digits, and x >= y
+  WIDE,     // x has 2n digits and y has n digits
+  EXPONENT  // x has n digits and y is a small exponent
+};
+
+struct Operation {
+  const char* name;
+  void (*run)(Operands&);
+  Shape shape;
+  int maxDigits;  // largest size swept by default
+};
+
+static const Operation operations[] = {
+  { "add",     benchAdd,     SAME,     16384 },
+  { "sub",     benchSub,     ORDERED,  16384 },
+  { "mul",     benchMul,     SAME,     2048 },
+  { "fastMul", benchFastMul, SAME,     2048 },
+  { "addmul",  benchAddmul,  SAME,     2048 },
+  { "divrem",  benchDivrem,  WIDE,     1024 },
+  { "pow",     benchPow,     EXPONENT, 512 },
+  { "gcd",     benchGcd,     SAME,     256 },
+  { "print",   benchPrint,   SAME,     16384 },
+  { "read",    benchRead,    SAME,     16384 },
+};
+static const int numOperations = sizeof(operations) / sizeof(operations[0]);
+static const int powExponent = 5;
+
+/******************** OPTIONS ********************/
+
+struct Base {
+  int base;
+  int pow;
+};
+
+struct Options {
+  vector<string> ops;
+  vector<Base> bases;
+  int minDigits;
+  int maxDigits;       // 0 means use each operation's default
+  double factor;       // ratio between consecutive sizes
+  double precision;    // target relative half-width of the 95% CI
+  double sampleTime;   // minimum seconds per sample
+  double warmupTime;   // seconds spent warming up each case
+  double maxTime;      // seconds before giving up on the precision
+  int minSamples;
+  int maxSamples;
+  double tolerance;    // allowed relative slowdown against the baseline
+  unsigned seed;
+  string csvFile;
+  string jsonFile;
+  string baselineFile;
+
+  Options()
+    :minDigits(1), maxDigits(0), factor(2), precision(0.02),
+     sampleTime(1e-4), warmupTime(0.01), maxTime(1), minSamples(10),
+     maxSamples(10000), tolerance(0.10), seed(1)
+  { }
+};
+
+static void usage (const char* prog) {
+  cerr << "usage: " << prog << " [options]\n"
+       << "  --ops LIST          comma-separated operations (default: all)\n"
+       << "                      add,sub,mul,fastMul,addmul,divrem,pow,gcd,print,read\n"
+       << "  --bases LIST        comma-separated base^pow (default: 2^15,16^3,10^4)\n"
+       << "  --min-digits N      smallest operand size in digits (default 1)\n"
+       << "  --max-digits N      largest operand size in digits (default: per op)\n"
+       << "  --factor F          geometric ratio between sizes (default 2)\n"
+       << "  --precision P       target relative 95% CI half-width (default 0.02)\n"
+       << "  --sample-time S     minimum seconds per sample (default 1e-4)\n"
+       << "  --warmup S          warm-up seconds per case (default 0.01)\n"
+       << "  --max-time S        time limit in seconds per case (default 1)\n"
+       << "  --min-samples N     (default 10)\n"
+       << "  --max-samples N     (default 10000)\n"
+       << "  --seed N            random seed for the operands (default 1)\n"
+       << "  --csv FILE          write results as CSV\n"
+       << "  --json FILE         write results as JSON\n"
+       << "  --baseline FILE     compare medians against an earlier CSV\n"
+       << "  --tolerance T       allowed relative slowdown (default 0.10)\n";
+  exit(2);
+}
+
+static vector<string> split (const string& s, char sep) {
+  vector<string> parts;
+  istringstream in(s);
+  string part;
+  while (getline(in, part, sep))
+    if (!part.empty()) parts.push_back(part);
+  return parts;
+}
+
+static Options parseOptions (int argc, char** argv) {
+  Options opts;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "-h" || arg == "--help" || i+1 >= argc) usage(argv[0]);
+    string val = argv[++i];
+    if (arg == "--ops") opts.ops = split(val, ',');
+    else if (arg == "--bases") {
+      vector<string> parts = split(val, ',');
+      for (int j = 0; j < parts.size(); ++j) {
+        Base b = { 0, 1 };
+        if (sscanf(parts[j].c_str(), "%d^%d", &b.base, &b.pow) < 1
+            || b.base < 2 || b.base > 36 || b.pow < 1)
+          usage(argv[0]);
+        opts.bases.push_back(b);
+      }
+    }
+    else if (arg == "--min-digits") opts.minDigits = atoi(val.c_str());
+    else if (arg == "--max-digits") opts.maxDigits = atoi(val.c_str());
+    else if (arg == "--factor") opts.factor = atof(val.c_str());
+    else if (arg == "--precision") opts.precision = atof(val.c_str());
+    else if (arg == "--sample-time") opts.sampleTime = atof(val.c_str());
+    else if (arg == "--warmup") opts.warmupTime = atof(val.c_str());
+    else if (arg == "--max-time") opts.maxTime = atof(val.c_str());
+    else if (arg == "--min-samples") opts.minSamples = atoi(val.c_str());
+    else if (arg == "--max-samples") opts.maxSamples = atoi(val.c_str());
+    else if (arg == "--seed") opts.seed = atoi(val.c_str());
+    else if (arg == "--csv") opts.csvFile = val;
+    else if (arg == "--json") opts.jsonFile = val;
+    else if (arg == "--baseline") opts.baselineFile = val;
+    else if (arg == "--tolerance") opts.tolerance = atof(val.c_str());
+    else usage(argv[0]);
+  }
+
+  if (opts.minDigits < 1 || opts.factor <= 1 || opts.minSamples < 2
+      || opts.maxSamples < opts.minSamples)
+    usage(argv[0]);
+  if (opts.bases.empty()) {
+    Base defaults[] = { {2, 15}, {16, 3}, {10, 4} };
+    opts.bases.assign(defaults, defaults + 3);
+  }
+  for (int i = 0; i < opts.ops.size(); ++i) {
+    int j = 0;
+    while (j < numOperations && opts.ops[i] != operations[j].name) ++j;
+    if (j == numOperations) {
+      cerr << "unknown operation: " << opts.ops[i] << endl;
+      usage(argv[0]);
+    }
+  }
+  return opts;
+}
+
+/******************** OPERANDS ********************/
+
+// Returns a random number with exactly n digits in base^pow,
+// written out in base.
+static string randomText (int n, const Base& b) {
+  static const char symbols[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+  string s(n * b.pow, '0');
+  s[0] = symbols[1 + rand() % (b.base - 1)];
+  for (int i = 1; i < s.size(); ++i)
+    s[i] = symbols[rand() % b.base];
+  return s;
+}
+
+static void makeOperands (Operands& o, Shape shape, int n, const Base& b) {
+  o.text = randomText(n, b);
+  o.x.read(o.text.c_str());
+  switch (shape) {
+    case SAME:
+      o.y.read(randomText(n, b).c_str());
+      break;
+    case ORDERED:
+      o.y.read(randomText(n, b).c_str());
+      if (o.x.compare(o.y) < 0) {
+        PosInt temp(o.x);
+        o.x.set(o.y);
+        o.y.set(temp);
+        ostringstream out;
+        o.x.print(out);
+        o.text = out.str();
+      }
+      break;
+    case WIDE:
+      o.text = randomText(2*n, b);
+      o.x.read(o.text.c_str());
+      o.y.read(randomText(n, b).c_str());
+      break;
+    case EXPONENT:
+      o.y.set(powExponent);
+      break;
+  }
+}
+
+/******************** STATISTICS ********************/
+
+struct Result {
+  string op;
+  Base base;
+  int digits;
+  long samples;
+  long reps;       // operations per sample
+  double median;   // all times are nanoseconds per operation
+  double p10;
+  double p90;
+  double mean;
+  double ci;       // half-width of the 95% confidence interval of the mean
+  double baseline; // median from the baseline, or 0 if there is none
+};
+
+static double seconds (Clock::duration d) {
+  return chrono::duration<double>(d).count();
+}
+
+// Linear interpolation between the closest ranks of sorted data.
+static double percentile (const vector<double>& sorted, double p) {
+  double pos = p * (sorted.size() - 1);
+  int lo = (int)pos;
+  if (lo + 1 >= sorted.size()) return sorted.back();
+  return sorted[lo] + (pos - lo) * (sorted[lo+1] - sorted[lo]);
+}
+
+// Two-sided 95% critical value of Student's t with df degrees of freedom.
+static double tCritical (long df) {
+  static const double table[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+  };
+  if (df <= 30) return table[df-1];
+  else return 1.96 + 2.4 / df;
+}
+
+// Times one sample of reps calls, in nanoseconds per call.
+static double sample (const Operation& op, Operands& o, long reps) {
+  Clock::time_point start = Clock::now();
+  for (long i = 0; i < reps; ++i) op.run(o);
+  return 1e9 * seconds(Clock::now() - start) / reps;
+}
+
+static Result measure (const Operation& op, Operands& o, const Options& opts) {
+  Result res;
+  res.op = op.name;
+  res.baseline = 0;
+
+  // Warm up caches and the allocator, and find out how many calls
+  // are needed for a sample to last at least sampleTime.
+  long reps = 1;
+  Clock::time_point start = Clock::now();
+  while (true) {
+    double t = sample(op, o, reps) * 1e-9 * reps;
+    if (t >= opts.sampleTime) {
+      if (seconds(Clock::now() - start) >= opts.warmupTime) break;
+    }
+    else reps = t > 0 ? (long)ceil(reps * 1.2 * opts.sampleTime / t) : 2*reps;
+  }
+
+  vector<double> times;
+  double sum = 0, sumsq = 0;
+  start = Clock::now();
+  while (true) {
+    double t = sample(op, o, reps);
+    times.push_back(t);
+    sum += t;
+    sumsq += t*t;
+    long n = times.size();
+    if (n < opts.minSamples) continue;
+    res.mean = sum / n;
+    double var = max(0.0, (sumsq - sum*res.mean) / (n-1));
+    res.ci = tCritical(n-1) * sqrt(var / n);
+    if (res.ci <= opts.precision * res.mean
+        || n >= opts.maxSamples
+        || seconds(Clock::now() - start) >= opts.maxTime)
+      break;
+  }
+
+  sort(times.begin(), times.end());
+  res.samples = times.size();
+  res.reps = reps;
+  res.median = percentile(times, 0.5);
+  res.p10 = percentile(times, 0.1);
+  res.p90 = percentile(times, 0.9);
+  return res;
+}
+
+/******************** OUTPUT ********************/
+
+static string caseKey (const string& op, int base, int pow, int digits) {
+  ostringstream key;
+  key << op << ' ' << base << '^' << pow << ' ' << digits;
+  return key.str();
+}
+
+// Reads the medians from a CSV file written by --csv.
+static map<string, double> readBaseline (const string& file) {
+  map<string, double> medians;
+  ifstream in(file.c_str());
+  if (!in) {
+    cerr << "can't read baseline " << file << endl;
+    exit(2);
+  }
+  string line;
+  getline(in, line);  // header
+  while (getline(in, line)) {
+    vector<string> fields = split(line, ',');
+    if (fields.size() < 7) continue;
+    medians[caseKey(fields[0], atoi(fields[1].c_str()),
+      atoi(fields[2].c_str()), atoi(fields[3].c_str()))]
+      = atof(fields[6].c_str());
+  }
+  return medians;
+}
+
+static void writeCsv (const string& file, const vector<Result>& results) {
+  ofstream out(file.c_str());
+  out << "op,base,pow,digits,samples,reps,median_ns,p10_ns,p90_ns,"
+      << "mean_ns,ci95_ns,baseline_ns\n";
+  for (int i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    out << r.op << ',' << r.base.base << ',' << r.base.pow << ','
+        << r.digits << ',' << r.samples << ',' << r.reps << ','
+        << r.median << ',' << r.p10 << ',' << r.p90 << ','
+        << r.mean << ',' << r.ci << ',' << r.baseline << '\n';
+  }
+}
+
+static void writeJson (const string& file, const vector<Result>& results) {
+  ofstream out(file.c_str());
+  out << "[\n";
+  for (int i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    out << "  {\"op\": \"" << r.op << "\", \"base\": " << r.base.base
+        << ", \"pow\": " << r.base.pow << ", \"digits\": " << r.digits
+        << ", \"samples\": " << r.samples << ", \"reps\": " << r.reps
+        << ", \"median_ns\": " << r.median << ", \"p10_ns\": " << r.p10
+        << ", \"p90_ns\": " << r.p90 << ", \"mean_ns\": " << r.mean
+        << ", \"ci95_ns\": " << r.ci << ", \"baseline_ns\": " << r.baseline
+        << "}" << (i+1 < results.size() ? "," : "") << "\n";
+  }
+  out << "]\n";
+}
+
+/******************** MAIN ********************/
+
+int main (int argc, char** argv) {
+  Options opts = parseOptions(argc, argv);
+  map<string, double> baseline;
+  if (!opts.baselineFile.empty()) baseline = readBaseline(opts.baselineFile);
+
+  vector<Result> results;
+  int regressions = 0;
+
+  printf("%-8s %-6s %7s %7s %12s %12s %12s %7s %s\n", "op", "base",
+    "digits", "samples", "median(ns)", "p10(ns)", "p90(ns)", "ci95", "");
+  for (int bi = 0; bi < opts.bases.size(); ++bi) {
+    const Base& b = opts.bases[bi];
+    PosInt::setBase(b.base, b.pow);
+    srand(opts.seed);
+
+    for (int oi = 0; oi < numOperations; ++oi) {
+      const Operation& op = operations[oi];
+      if (!opts.ops.empty()
+          && find(opts.ops.begin(), opts.ops.end(), op.name) == opts.ops.end())
+        continue;
+      int maxDigits = opts.maxDigits > 0 ? opts.maxDigits : op.maxDigits;
+
+      int lastDigits = 0;
+      for (double size = opts.minDigits; size <= maxDigits; size *= opts.factor) {
+        int digits = (int)(size + 0.5);
+        if (digits == lastDigits) continue;
+        lastDigits = digits;
+
+        Operands o;
+        makeOperands(o, op.shape, digits, b);
+        Result r = measure(op, o, opts);
+        r.base = b;
+        r.digits = digits;
+
+        string status;
+        map<string, double>::const_iterator it =
+          baseline.find(caseKey(r.op, b.base, b.pow, digits));
+        if (it != baseline.end() && it->second > 0) {
+          r.baseline = it->second;
+          double change = r.median / r.baseline - 1;
+          char buf[64];
+          snprintf(buf, sizeof(buf), "%+.1f%%", 100 * change);
+          status = buf;
+          if (change > opts.tolerance) {
+            status += " REGRESSION";
+            ++regressions;
+          }
+        }
+
+        char basebuf[16];
+        snprintf(basebuf, sizeof(basebuf), "%d^%d", b.base, b.pow);
+        printf("%-8s %-6s %7d %7ld %12.1f %12.1f %12.1f %6.1f%% %s\n",
+          r.op.c_str(), basebuf, r.digits, r.samples, r.median, r.p10,
+          r.p90, 100 * r.ci / r.mean, status.c_str());
+        fflush(stdout);
+        results.push_back(r);
+      }
+    }
+  }
+
+  if (!opts.csvFile.empty()) writeCsv(opts.csvFile, results);
+  if (!opts.jsonFile.empty()) writeJson(opts.jsonFile, results);
+
+  if (regressions > 0) {
+    fprintf(stderr, "\n*** %d case(s) regressed by more than %.0f%% "
+      "against %s ***\n", regressions, 100 * opts.tolerance,
+      opts.baselineFile.c_str());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,95 @@
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include "diskint.h"
+using namespace std;
+
+/* Checks DiskPosInt::mul against PosInt::fastMul, with budgets that
+ * make it split the operands into blocks both shorter and longer than
+ * FASTMUL_CROSSOVER (256 digits), and lengths that leave a short last
+ * block. The files are created in /tmp and removed afterwards.
+ * Exits with status 1 if any result is wrong.
+ */
+
+static int failures = 0;
+static int base, basePow;  // the current base is base^basePow
+
+static void check (bool ok, const char* what) {
+  if (!ok) {
+    cerr << "base " << base << "^" << basePow << ": " << what
+         << " is wrong" << endl;
+    ++failures;
+  }
+}
+
+static string tempPath (const char* name) {
+  return "/tmp/diskcheck." + to_string((long)getpid()) + "." + name;
+}
+
+// A random number with exactly n digits
+static PosInt randDigits (int n) {
+  PosInt lim(base), x;
+  lim.pow(PosInt((n-1) * basePow));
+  x.rand(lim);
+  x.add(lim);
+  return x;
+}
+
+// mul uses blocks of memBudget/60 digits
+static void checkMul (int xlen, int ylen, long memBudget, const char* what) {
+  PosInt x = randDigits(xlen), y = randDigits(ylen);
+  string px = tempPath("x"), py = tempPath("y"), pz = tempPath("z");
+  PosInt z;
+  {
+    DiskPosInt dx(px.c_str()), dy(py.c_str()), dz(pz.c_str());
+    dx.set(x);
+    dy.set(y);
+    dz.mul(dx, dy, memBudget);
+    dz.get(z);
+  }
+  unlink(px.c_str());
+  unlink(py.c_str());
+  unlink(pz.c_str());
+
+  x.fastMul(y);
+  check(z.compare(x) == 0, what);
+}
+
+// Files that don't hold a whole number of digits are rejected
+static void checkOddSize () {
+  string p = tempPath("odd");
+  FILE* f = fopen(p.c_str(), "wb");
+  fwrite("abcdef", 1, 6, f);
+  fclose(f);
+  bool thrown = false;
+  try {
+    DiskPosInt d(p.c_str());
+  }
+  catch (const MPError&) {
+    thrown = true;
+  }
+  unlink(p.c_str());
+  check(thrown, "opening a file of 6 bytes");
+}
+
+int main () {
+  int bases[][2] = { {2, 15}, {10, 4} };
+  for (int i = 0; i < 2; ++i) {
+    base = bases[i][0];
+    basePow = bases[i][1];
+    PosInt::setBase(base, basePow);
+    // 100-digit blocks: below the crossover
+    checkMul(1000, 350, 6000, "mul, blocks below the crossover");
+    checkMul(777, 1, 6000, "mul by one digit");
+    // 300-digit blocks: padded for fastMulArray
+    checkMul(1000, 700, 18000, "mul, blocks above the crossover");
+    checkMul(300, 1250, 18000, "mul, longer second operand");
+    // One block holding all of x, and a padded y
+    checkMul(2000, 500, 10000000, "mul in a single block");
+    checkOddSize();
+  }
+  if (failures > 0) return 1;
+  cout << "DiskPosInt: all checks passed" << endl;
+  return 0;
+}
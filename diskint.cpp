@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "diskint.h"
+using namespace std;
+
+/******************** FILES ********************/
+
+DiskPosInt::DiskPosInt (const char* p) :path(p), fd(-1), digits(NULL), len(0) {
+  fd = open(p, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) throw MPError("Can't open DiskPosInt file");
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    throw MPError("Can't stat DiskPosInt file");
+  }
+  if (st.st_size % sizeof(int) != 0) {
+    close(fd);
+    throw MPError("DiskPosInt file is not a whole number of digits");
+  }
+  // Maps the file as it is, rather than with resize(), so that fd can
+  // be closed if the mapping fails
+  long n = st.st_size / sizeof(int);
+  if (n > 0) {
+    void* addr = mmap(NULL, n * sizeof(int),
+      PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+      close(fd);
+      throw MPError("Can't map DiskPosInt file");
+    }
+    digits = (int*) addr;
+    len = n;
+  }
+}
+
+DiskPosInt::~DiskPosInt () {
+  if (digits != NULL) munmap(digits, len * sizeof(int));
+  close(fd);
+}
+
+// Resizes the file to hold newlen digits, and maps it.
+// New digits are zero.
+void DiskPosInt::resize (long newlen) {
+  if (digits != NULL) munmap(digits, len * sizeof(int));
+  digits = NULL;
+  len = 0;
+  if (ftruncate(fd, newlen * sizeof(int)) < 0)
+    throw MPError("Can't resize DiskPosInt file");
+  if (newlen > 0) {
+    void* addr = mmap(NULL, newlen * sizeof(int),
+      PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) throw MPError("Can't map DiskPosInt file");
+    digits = (int*) addr;
+  }
+  len = newlen;
+}
+
+// Removes leading 0 digits
+void DiskPosInt::normalize () {
+  long i;
+  for (i = len-1; i >= 0 && digits[i] == 0; --i);
+  if (i+1 < len) resize(i+1);
+}
+
+void DiskPosInt::set (const PosInt& x) {
+  resize(x.digits.size());
+  if (len > 0) memcpy(digits, &x.digits[0], len * sizeof(int));
+}
+
+void DiskPosInt::get (PosInt& x) const {
+  x.digits.assign(digits, digits + len);
+}
+
+/******************** PAGING ********************/
+
+static long pageSize () {
+  static long size = sysconf(_SC_PAGESIZE);
+  return size;
+}
+
+// Asks the kernel to start reading a[start, end) in the background.
+static void prefetch (const int* a, long start, long end) {
+  if (start >= end) return;
+  long page = pageSize();
+  uintptr_t lo = (uintptr_t)(a + start) / page * page;
+  uintptr_t hi = (uintptr_t)(a + end);
+  madvise((void*)lo, hi - lo, MADV_WILLNEED);
+}
+
+// Drops the pages wholly inside a[start, end) from memory. Dirty pages
+// of the result are queued for writeback first; a shared file mapping
+// keeps their contents, so they are read back if they are needed again.
+static void release (int* a, long start, long end, bool dirty) {
+  long page = pageSize();
+  uintptr_t lo = ((uintptr_t)(a + start) + page - 1) / page * page;
+  uintptr_t hi = (uintptr_t)(a + end) / page * page;
+  if (lo >= hi) return;
+  if (dirty) msync((void*)lo, hi - lo, MS_ASYNC);
+  madvise((void*)lo, hi - lo, MADV_DONTNEED);
+}
+
+// Copies block i (of length b) of a, which has len digits, into dest,
+// releases it from memory, and returns its length.
+static int loadBlock (int* dest, const int* a, long len, long i, long b) {
+  long start = i * b;
+  long end = min(len, start + b);
+  memcpy(dest, a + start, (end - start) * sizeof(int));
+  release(const_cast<int*>(a), start, end, false);
+  return end - start;
+}
+
+/******************** MULTIPLICATION ********************/
+
+// this = x * y, computed one pair of blocks at a time.
+// Block product k = i + j of x's block i and y's block j is added to
+// the result at offset k*b. The pairs are visited by increasing k, so
+// the result is written front to back, and result block k is final
+// (and can be written back) once all pairs with that k are done.
+// Only two blocks of the operands, their product, fastMulArray's
+// temporaries and a window of the result are resident at once.
+void DiskPosInt::mul (const DiskPosInt& x, const DiskPosInt& y, long memBudget) {
+  if (&x == this || &y == this)
+    throw MPError("DiskPosInt::mul can't overwrite one of its operands");
+  if (x.len == 0 || y.len == 0) {
+    resize(0);
+    return;
+  }
+
+  // Resident ints per block digit: 2 operand blocks, the 2b product,
+  // about 7b of fastMulArray temporaries, and 4b of result window and
+  // prefetched operands.
+  long b = memBudget / (15 * (long)sizeof(int));
+  b = max(1L, min(b, max(x.len, y.len)));
+  b = min(b, 1L << 28);
+  long nx = (x.len + b - 1) / b;
+  long ny = (y.len + b - 1) / b;
+
+  resize(0);
+  resize((nx + ny) * b);
+
+  int* xb = new int[b];
+  int* yb = new int[b];
+  int* prod = new int[2*b];
+
+  for (long k = 0; k < nx + ny - 1; ++k) {
+    long ilo = max(0L, k - (ny - 1));
+    long ihi = min(k, nx - 1);
+    prefetch(digits, k*b, (k+2)*b);
+    for (long i = ilo; i <= ihi; ++i) {
+      long j = k - i;
+
+      // Start reading the next pair while this one is multiplied
+      long ni = i + 1, nj = j - 1;
+      if (ni > ihi) {
+        ni = max(0L, k + 1 - (ny - 1));
+        nj = k + 1 - ni;
+      }
+      if (ni < nx && nj >= 0 && nj < ny) {
+        prefetch(x.digits, ni*b, min(x.len, (ni+1)*b));
+        prefetch(y.digits, nj*b, min(y.len, (nj+1)*b));
+      }
+
+      int xblen = loadBlock(xb, x.digits, x.len, i, b);
+      int yblen = loadBlock(yb, y.digits, y.len, j, b);
+      if (b >= PosInt::FASTMUL_CROSSOVER) {
+        // fastMulArray needs equal lengths: zero-pad a short last block
+        memset(xb + xblen, 0, (b - xblen) * sizeof(int));
+        memset(yb + yblen, 0, (b - yblen) * sizeof(int));
+        memset(prod, 0, 2*b * sizeof(int));
+        PosInt::fastMulArray(prod, xb, yb, b);
+      }
+      else
+        PosInt::mulArray(prod, xb, xblen, yb, yblen);
+      PosInt::addArray(digits + k*b, prod, xblen + yblen);
+    }
+    release(digits, k*b, (k+1)*b, true);
+  }
+
+  delete [] xb;
+  delete [] yb;
+  delete [] prod;
+
+  normalize();
+  msync(digits, len * sizeof(int), MS_SYNC);
+}
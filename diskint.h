@@ -0,0 +1,49 @@
+#ifndef DISKINT_H
+#define DISKINT_H
+
+#include <string>
+#include "posint.h"
+
+/* This class represents a PosInt whose digits live in a memory-mapped
+ * file instead of in memory, for numbers whose products (and the
+ * temporaries needed to compute them) don't fit in RAM.
+ * The file holds the digits as raw ints, starting from the
+ * least-significant digit, in whatever base PosInt is set to.
+ */
+class DiskPosInt {
+  private:
+    std::string path;
+    int fd;
+    int* digits;  // the mapped file, or NULL if there are no digits
+    long len;     // number of digits
+
+    // Resizes the file to hold newlen digits, and maps it
+    void resize (long newlen);
+    // Removes leading 0 digits, shrinking the file
+    void normalize ();
+
+    // Not copyable: two objects would share the same file
+    DiskPosInt (const DiskPosInt&);
+    DiskPosInt& operator= (const DiskPosInt&);
+
+  public:
+    // Opens the file at path, creating an empty (zero) one if needed.
+    // Throws if its size is not a whole number of ints.
+    explicit DiskPosInt (const char* path);
+    ~DiskPosInt ();
+
+    // Number of digits
+    long size () const { return len; }
+
+    // Writes x to the file
+    void set (const PosInt& x);
+
+    // Reads the file into x
+    void get (PosInt& x) const;
+
+    // this = x * y, keeping at most about memBudget bytes of digits
+    // resident at once. x and y must be other files than this one.
+    void mul (const DiskPosInt& x, const DiskPosInt& y, long memBudget);
+};
+
+#endif // DISKINT_H
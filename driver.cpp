@@ -51,15 +51,17 @@ int main() {
   cout << "trialsPerDigit: " << trialsPerDigit << endl;
 
   PosInt one(1);
-  PosInt two(2);
-  PosInt four(4);
-  PosInt five(5);
   PosInt basePosInt(base);
 
-  PosInt baseToFive(basePosInt);
-  baseToFive.pow(five);
+  // If base is a power of 2, multiplying by base^k is a shift by
+  // k*baseBits bits; otherwise multiply by the powers of base.
+  int baseBits = 0;
+  while ((1 << baseBits) < base) ++baseBits;
+  bool baseIsPow2 = (1 << baseBits) == base;
   PosInt baseToFour(basePosInt);
-  baseToFour.pow(four);
+  baseToFour.pow(PosInt(4));
+  PosInt baseToFive(basePosInt);
+  baseToFive.pow(PosInt(5));
   
   PosInt lowerBound(one);
   PosInt upperBound(basePosInt);
@@ -112,8 +114,14 @@ int main() {
     }
 
     lowerBound.set(upperBound);
-    lowerBound.mul(baseToFour);
-    upperBound.mul(baseToFive);
+    if (baseIsPow2) {
+      lowerBound.shiftLeft(4 * baseBits);
+      upperBound.shiftLeft(5 * baseBits);
+    }
+    else {
+      lowerBound.mul(baseToFour);
+      upperBound.mul(baseToFive);
+    }
     upperLowerDiff.set(upperBound);
     upperLowerDiff.sub(lowerBound);
   }
@@ -0,0 +1,85 @@
+#include <iostream>
+#include "fixedposint.h"
+using namespace std;
+
+/* Instantiates FixedPosInt and FixedMontgomery at several widths, so
+ * that changes to PosInt that break the header are caught by make, and
+ * checks their results against PosInt on random operands.
+ * Exits with status 1 if any result is wrong.
+ */
+
+static int failures = 0;
+
+static void check (bool ok, const char* what, int bits) {
+  if (!ok) {
+    cerr << "FixedPosInt<" << bits << ">: " << what << " is wrong" << endl;
+    ++failures;
+  }
+}
+
+template <int Bits>
+static void checkWidth (int rounds) {
+  typedef FixedPosInt<Bits> Num;
+  PosInt R(1);
+  R.shiftLeft(Bits);
+
+  for (int i = 0; i < rounds; ++i) {
+    PosInt a, b, n, back, ref, q;
+    a.rand(R);
+    b.rand(R);
+    n.rand(R);
+    if (!n.testBit(0)) n.setBit(0);
+
+    Num fa(a), fb(b), fn(n);
+    fa.get(back);
+    check(back.compare(a) == 0, "set/get", Bits);
+
+    Num s(fa);
+    uint32_t carry = s.add(fb);
+    ref.set(a);
+    ref.add(b);
+    s.get(back);
+    check(carry == (uint32_t)ref.testBit(Bits), "add carry", Bits);
+    ref.mod(R);
+    check(back.compare(ref) == 0, "add", Bits);
+
+    Num d(fa);
+    uint32_t borrow = d.sub(fb);
+    check((borrow != 0) == (a.compare(b) < 0), "sub borrow", Bits);
+    check((fa.lessMask(fb) != 0) == (a.compare(b) < 0), "lessMask", Bits);
+
+    Num m(fa);
+    m.mul(fb);
+    ref.set(a);
+    ref.mul(b);
+    ref.mod(R);
+    m.get(back);
+    check(back.compare(ref) == 0, "mul", Bits);
+
+    // Montgomery: a^b mod n, against PosInt::powmod
+    PosInt an(a);
+    an.mod(n);
+    FixedMontgomery<Bits> mont(fn);
+    Num xa(an), ma, pr, rr;
+    mont.toMont(ma, xa);
+    mont.pow(pr, ma, fb);
+    mont.fromMont(rr, pr);
+    PosInt::powmod(ref, an, b, n);
+    rr.get(back);
+    check(back.compare(ref) == 0, "Montgomery pow", Bits);
+  }
+}
+
+int main () {
+  int bases[][2] = { {2, 15}, {10, 4} };
+  for (int i = 0; i < 2; ++i) {
+    PosInt::setBase(bases[i][0], bases[i][1]);
+    checkWidth<32>(20);
+    checkWidth<256>(10);
+    checkWidth<512>(5);
+    checkWidth<2048>(1);
+  }
+  if (failures > 0) return 1;
+  cout << "FixedPosInt: all checks passed" << endl;
+  return 0;
+}
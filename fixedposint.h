@@ -0,0 +1,268 @@
+#ifndef FIXEDPOSINT_H
+#define FIXEDPOSINT_H
+
+#include <stdint.h>
+#include "posint.h"
+
+/* This class represents an integer between 0 and 2^Bits - 1, stored
+ * on the stack as Bits/32 limbs of 32 bits, starting from the
+ * least-significant limb. It is meant for cryptographic sizes
+ * (256 to 2048 bits), where PosInt's vector and run-time lengths
+ * cost more than the arithmetic itself.
+ *
+ * Every loop runs over the compile-time number of limbs, so the
+ * compiler can unroll them, and none of the arithmetic branches on or
+ * indexes by the values: the time taken only depends on Bits, so it
+ * can be used on secret data. Only the conversions to and from PosInt
+ * are not constant-time.
+ */
+template <int Bits>
+class FixedPosInt {
+  public:
+    static const int N = Bits / 32;
+
+    uint32_t limb[N];
+
+    // Default constructor. Initializes to zero
+    FixedPosInt() { setZero(); }
+
+    // Constructor from a 32-bit value
+    explicit FixedPosInt (uint32_t x) { setZero(); limb[0] = x; }
+
+    // Constructor from a PosInt, which must be less than 2^Bits
+    explicit FixedPosInt (const PosInt& x) { set(x); }
+
+    void setZero() {
+      for (int i = 0; i < N; ++i) limb[i] = 0;
+    }
+
+    // Sets this to x, which must be less than 2^Bits
+    void set (const PosInt& x) {
+      setZero();
+      for (int i = (int)x.digits.size() - 1; i >= 0; --i) {
+        if (mulSmall(PosInt::B, x.digits[i]) != 0)
+          throw MPError("PosInt too large for FixedPosInt");
+      }
+    }
+
+    // Sets x to the value of this
+    void get (PosInt& x) const {
+      FixedPosInt q(*this);
+      x.digits.clear();
+      while (!q.isZeroVartime())
+        x.digits.push_back(q.divSmall(PosInt::B));
+    }
+
+    // Returns all ones if this is zero, and 0 otherwise
+    uint32_t isZeroMask () const {
+      uint32_t acc = 0;
+      for (int i = 0; i < N; ++i) acc |= limb[i];
+      return (uint32_t)(((uint64_t)acc - 1) >> 32);
+    }
+
+    // Returns all ones if this < x, and 0 otherwise
+    uint32_t lessMask (const FixedPosInt& x) const {
+      FixedPosInt d(*this);
+      return 0 - d.sub(x);
+    }
+
+    // this = this + x mod 2^Bits, returning the carry out (0 or 1)
+    uint32_t add (const FixedPosInt& x) {
+      uint64_t carry = 0;
+      for (int i = 0; i < N; ++i) {
+        carry += (uint64_t)limb[i] + x.limb[i];
+        limb[i] = (uint32_t)carry;
+        carry >>= 32;
+      }
+      return (uint32_t)carry;
+    }
+
+    // this = this - x mod 2^Bits, returning the borrow out (0 or 1)
+    uint32_t sub (const FixedPosInt& x) {
+      uint64_t borrow = 0;
+      for (int i = 0; i < N; ++i) {
+        uint64_t diff = (uint64_t)limb[i] - x.limb[i] - borrow;
+        limb[i] = (uint32_t)diff;
+        borrow = diff >> 63;
+      }
+      return (uint32_t)borrow;
+    }
+
+    // this = x if mask is all ones; unchanged if mask is 0
+    void select (const FixedPosInt& x, uint32_t mask) {
+      for (int i = 0; i < N; ++i)
+        limb[i] ^= mask & (limb[i] ^ x.limb[i]);
+    }
+
+    // Swaps this and x if mask is all ones; nothing if mask is 0
+    void swap (FixedPosInt& x, uint32_t mask) {
+      for (int i = 0; i < N; ++i) {
+        uint32_t t = mask & (limb[i] ^ x.limb[i]);
+        limb[i] ^= t;
+        x.limb[i] ^= t;
+      }
+    }
+
+    // Computes dest = x * y in full, with Comba's method: the result
+    // is built column by column in a three-limb accumulator, so each
+    // limb of dest is written exactly once.
+    // dest must have 2*N limbs.
+    static void mulWide (uint32_t* dest, const FixedPosInt& x, const FixedPosInt& y) {
+      uint64_t acc = 0;
+      uint32_t over = 0;
+      for (int k = 0; k < 2*N-1; ++k) {
+        int lo = k < N ? 0 : k-N+1;
+        int hi = k < N ? k : N-1;
+        for (int i = lo; i <= hi; ++i) {
+          uint64_t p = (uint64_t)x.limb[i] * y.limb[k-i];
+          acc += p;
+          over += acc < p;
+        }
+        dest[k] = (uint32_t)acc;
+        acc = (acc >> 32) | ((uint64_t)over << 32);
+        over = 0;
+      }
+      dest[2*N-1] = (uint32_t)acc;
+    }
+
+    // this = this * x mod 2^Bits
+    void mul (const FixedPosInt& x) {
+      uint32_t wide[2*N];
+      mulWide(wide, *this, x);
+      for (int i = 0; i < N; ++i) limb[i] = wide[i];
+    }
+
+  private:
+    // this = this * m + a, returning the limb shifted out
+    uint32_t mulSmall (uint32_t m, uint32_t a) {
+      uint64_t carry = a;
+      for (int i = 0; i < N; ++i) {
+        carry += (uint64_t)limb[i] * m;
+        limb[i] = (uint32_t)carry;
+        carry >>= 32;
+      }
+      return (uint32_t)carry;
+    }
+
+    // this = this / d, returning this % d
+    uint32_t divSmall (uint32_t d) {
+      uint64_t r = 0;
+      for (int i = N-1; i >= 0; --i) {
+        r = (r << 32) | limb[i];
+        limb[i] = (uint32_t)(r / d);
+        r %= d;
+      }
+      return (uint32_t)r;
+    }
+
+    bool isZeroVartime () const {
+      for (int i = 0; i < N; ++i)
+        if (limb[i] != 0) return false;
+      return true;
+    }
+
+    static_assert(Bits > 0 && Bits % 32 == 0,
+      "FixedPosInt needs a positive multiple of 32 bits");
+};
+
+/* Montgomery arithmetic modulo a fixed odd number n < 2^Bits, with
+ * R = 2^Bits. Numbers in Montgomery form are stored as a*R mod n,
+ * and every operation is constant-time.
+ */
+template <int Bits>
+class FixedMontgomery {
+  public:
+    typedef FixedPosInt<Bits> Num;
+    static const int N = Num::N;
+
+    // n must be odd
+    explicit FixedMontgomery (const Num& modulus) :n(modulus) {
+      if ((n.limb[0] & 1) == 0)
+        throw MPError("Montgomery modulus must be odd");
+
+      // -n^-1 mod 2^32, by Newton's iteration
+      uint32_t inv = n.limb[0];
+      for (int i = 0; i < 5; ++i) inv *= 2 - n.limb[0] * inv;
+      ninv = 0 - inv;
+
+      // R^2 mod n, by doubling 1 mod n 2*Bits times
+      r2.setZero();
+      r2.limb[0] = 1;
+      for (int i = 0; i < 2*Bits; ++i) {
+        uint32_t carry = r2.add(r2);
+        Num d(r2);
+        uint32_t borrow = d.sub(n);
+        r2.select(d, (0 - carry) | (borrow - 1));
+      }
+    }
+
+    const Num& modulus () const { return n; }
+
+    // r = a*R mod n, for a < n
+    void toMont (Num& r, const Num& a) const { mul(r, a, r2); }
+
+    // r = a/R mod n
+    void fromMont (Num& r, const Num& a) const {
+      uint32_t t[2*N];
+      for (int i = 0; i < N; ++i) {
+        t[i] = a.limb[i];
+        t[N+i] = 0;
+      }
+      reduce(r, t);
+    }
+
+    // r = a*b/R mod n
+    void mul (Num& r, const Num& a, const Num& b) const {
+      uint32_t t[2*N];
+      Num::mulWide(t, a, b);
+      reduce(r, t);
+    }
+
+    // r = a^e mod n, where a is in Montgomery form and so is r.
+    // Uses the Montgomery ladder, which does a multiplication and a
+    // squaring for every one of the Bits bits of e.
+    void pow (Num& r, const Num& a, const Num& e) const {
+      Num r0, r1(a);
+      Num one(1);
+      toMont(r0, one);
+      for (int i = Bits-1; i >= 0; --i) {
+        uint32_t bit = 0 - ((e.limb[i/32] >> (i%32)) & 1);
+        r0.swap(r1, bit);
+        mul(r1, r0, r1);
+        mul(r0, r0, r0);
+        r0.swap(r1, bit);
+      }
+      r = r0;
+    }
+
+  private:
+    Num n;
+    Num r2;        // R^2 mod n
+    uint32_t ninv; // -n^-1 mod 2^32
+
+    // r = t/R mod n, where t (2*N limbs) is less than n*R.
+    // t is overwritten.
+    void reduce (Num& r, uint32_t* t) const {
+      uint32_t top = 0;  // carry into t[i+N] left over from row i-1
+      for (int i = 0; i < N; ++i) {
+        uint32_t m = t[i] * ninv;
+        uint64_t carry = 0;
+        for (int j = 0; j < N; ++j) {
+          carry += (uint64_t)m * n.limb[j] + t[i+j];
+          t[i+j] = (uint32_t)carry;
+          carry >>= 32;
+        }
+        carry += (uint64_t)t[i+N] + top;
+        t[i+N] = (uint32_t)carry;
+        top = (uint32_t)(carry >> 32);
+      }
+
+      // The result is top:t[N..2N-1] < 2n; subtract n once if needed
+      for (int i = 0; i < N; ++i) r.limb[i] = t[N+i];
+      Num d(r);
+      uint32_t borrow = d.sub(n);
+      r.select(d, (0 - top) | (borrow - 1));
+    }
+};
+
+#endif // FIXEDPOSINT_H
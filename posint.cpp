@@ -1,7 +1,19 @@
+#include <algorithm>
 #include <cctype>
+#include <atomic>
+#include <climits>
 #include <cstdlib>
+#include <future>
 #include <string>
+#include <thread>
 #include <sstream>
+#ifdef POSINT_STATS
+#include <chrono>
+#include <mutex>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
 #include "posint.h"
 using namespace std;
 
@@ -10,6 +22,7 @@ using namespace std;
 int PosInt::B = 0x8000;
 int PosInt::Bbase = 2;
 int PosInt::Bpow = 15;
+int PosInt::Bbits = 15;
 
 void PosInt::setBase(int base, int pow) {
   Bbase = base;
@@ -19,6 +32,233 @@ void PosInt::setBase(int base, int pow) {
     B *= Bbase;
     --pow;
   }
+  for (Bbits = 0; (1 << Bbits) < B; ++Bbits);
+  if ((1 << Bbits) != B) Bbits = 0;
+}
+
+/******************** STATISTICS ********************/
+
+PosIntStats::PosIntStats() {
+  for (int k = 0; k < NKERNELS; ++k) {
+    Counters zero = { 0, 0, 0, 0, 0 };
+    kernel[k] = zero;
+  }
+}
+
+const char* PosIntStats::name (int k) {
+  static const char* names[NKERNELS] = {
+    "addArray", "subArray", "mulArray", "fastMulArray", "mulAccArray",
+    "divremArray", "mulDigit", "divDigit"
+  };
+  return names[k];
+}
+
+void PosIntStats::print (ostream& out) const {
+  for (int k = 0; k < NKERNELS; ++k) {
+    out << name(k) << ' ' << kernel[k].calls << ' ' << kernel[k].digits
+        << ' ' << kernel[k].maxDepth << ' ' << kernel[k].heapBytes
+        << ' ' << kernel[k].cycles << '\n';
+  }
+}
+
+#ifdef POSINT_STATS
+
+static inline unsigned long long readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return chrono::duration_cast<chrono::nanoseconds>
+    (chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// The counters of one thread. Only the owning thread ever writes to
+// them, so relaxed loads and stores are enough; they are atomic just
+// so that stats() can read them from another thread.
+struct StatSlot {
+  enum { CALLS, DIGITS, MAXDEPTH, HEAPBYTES, CYCLES, NCOUNTERS };
+  atomic<unsigned long long> count[PosIntStats::NKERNELS][NCOUNTERS];
+  int depth[PosIntStats::NKERNELS];
+  unsigned long long start[PosIntStats::NKERNELS];
+
+  StatSlot();
+  ~StatSlot();
+
+  void add (int k, int c, unsigned long long n) {
+    count[k][c].store(count[k][c].load(memory_order_relaxed) + n,
+      memory_order_relaxed);
+  }
+
+  void addTo (PosIntStats& total) const;
+  void reset();
+};
+
+// Every live thread's slot, plus the totals of threads that exited.
+struct StatRegistry {
+  mutex lock;
+  vector<StatSlot*> slots;
+  PosIntStats retired;
+};
+
+static StatRegistry& registry() {
+  static StatRegistry reg;
+  return reg;
+}
+
+static thread_local StatSlot statSlot;
+
+StatSlot::StatSlot() {
+  reset();
+  for (int k = 0; k < PosIntStats::NKERNELS; ++k) depth[k] = 0;
+  StatRegistry& reg = registry();
+  lock_guard<mutex> guard(reg.lock);
+  reg.slots.push_back(this);
+}
+
+StatSlot::~StatSlot() {
+  StatRegistry& reg = registry();
+  lock_guard<mutex> guard(reg.lock);
+  addTo(reg.retired);
+  for (int i = 0; i < reg.slots.size(); ++i) {
+    if (reg.slots[i] == this) {
+      reg.slots.erase(reg.slots.begin() + i);
+      break;
+    }
+  }
+}
+
+void StatSlot::addTo (PosIntStats& total) const {
+  for (int k = 0; k < PosIntStats::NKERNELS; ++k) {
+    PosIntStats::Counters& t = total.kernel[k];
+    t.calls += count[k][CALLS].load(memory_order_relaxed);
+    t.digits += count[k][DIGITS].load(memory_order_relaxed);
+    t.maxDepth = max(t.maxDepth, count[k][MAXDEPTH].load(memory_order_relaxed));
+    t.heapBytes += count[k][HEAPBYTES].load(memory_order_relaxed);
+    t.cycles += count[k][CYCLES].load(memory_order_relaxed);
+  }
+}
+
+void StatSlot::reset() {
+  for (int k = 0; k < PosIntStats::NKERNELS; ++k)
+    for (int c = 0; c < NCOUNTERS; ++c)
+      count[k][c].store(0, memory_order_relaxed);
+}
+
+// Counts one call of a kernel on len digits, and times it for as long
+// as this object lives if it is the outermost call of that kernel.
+class KernelScope {
+  private:
+    int k;
+  public:
+    KernelScope (int kernel, long len) :k(kernel) {
+      StatSlot& s = statSlot;
+      s.add(k, StatSlot::CALLS, 1);
+      s.add(k, StatSlot::DIGITS, len);
+      if (++s.depth[k] > s.count[k][StatSlot::MAXDEPTH].load(memory_order_relaxed))
+        s.count[k][StatSlot::MAXDEPTH].store(s.depth[k], memory_order_relaxed);
+      if (s.depth[k] == 1) s.start[k] = readCycles();
+    }
+    ~KernelScope() {
+      StatSlot& s = statSlot;
+      if (--s.depth[k] == 0)
+        s.add(k, StatSlot::CYCLES, readCycles() - s.start[k]);
+    }
+};
+
+#define STATS_KERNEL(k, len) KernelScope kernelScope_(PosIntStats::k, len)
+#define STATS_HEAP(k, bytes) statSlot.add(PosIntStats::k, StatSlot::HEAPBYTES, bytes)
+
+PosIntStats PosInt::stats (bool reset) {
+  PosIntStats total;
+  StatRegistry& reg = registry();
+  lock_guard<mutex> guard(reg.lock);
+  for (int i = 0; i < reg.slots.size(); ++i) {
+    reg.slots[i]->addTo(total);
+    if (reset) reg.slots[i]->reset();
+  }
+  for (int k = 0; k < PosIntStats::NKERNELS; ++k) {
+    PosIntStats::Counters& t = total.kernel[k];
+    const PosIntStats::Counters& r = reg.retired.kernel[k];
+    t.calls += r.calls;
+    t.digits += r.digits;
+    t.maxDepth = max(t.maxDepth, r.maxDepth);
+    t.heapBytes += r.heapBytes;
+    t.cycles += r.cycles;
+  }
+  if (reset) reg.retired = PosIntStats();
+  return total;
+}
+
+#else
+
+#define STATS_KERNEL(k, len)
+#define STATS_HEAP(k, bytes)
+
+PosIntStats PosInt::stats (bool reset) {
+  return PosIntStats();
+}
+
+#endif // POSINT_STATS
+
+/******************** DIGIT STORAGE ********************/
+
+DigitVector::DigitVector (const DigitVector& d) :own(d.own), rep(d.rep) {
+  if (rep) rep->refs.fetch_add(1, memory_order_relaxed);
+}
+
+DigitVector::DigitVector (DigitVector&& d) :own(std::move(d.own)), rep(d.rep) {
+  d.rep = NULL;
+}
+
+DigitVector& DigitVector::operator= (const DigitVector& d) {
+  Rep* shared = d.rep;
+  if (shared) {
+    shared->refs.fetch_add(1, memory_order_relaxed);
+    // own is only used while rep is NULL; free the old digits
+    vector<int>().swap(own);
+  }
+  else if (this != &d) own = d.own;
+  release();
+  rep = shared;
+  return *this;
+}
+
+DigitVector& DigitVector::operator= (DigitVector&& d) {
+  if (this != &d) {
+    release();
+    own = std::move(d.own);
+    rep = d.rep;
+    d.rep = NULL;
+  }
+  return *this;
+}
+
+void DigitVector::release() {
+  if (rep && rep->refs.fetch_sub(1, memory_order_acq_rel) == 1)
+    delete rep;
+  rep = NULL;
+}
+
+vector<int>& DigitVector::unshare() {
+  if (rep->refs.load(memory_order_acquire) != 1) {
+    if (rep->v.size() >= SHARE_MIN) {
+      Rep* copy = new Rep;
+      copy->v = rep->v;
+      release();
+      rep = copy;
+    }
+    else {
+      own = rep->v;
+      release();
+      return own;
+    }
+  }
+  return rep->v;
+}
+
+void DigitVector::share() {
+  rep = new Rep;
+  rep->v.swap(own);
 }
 
 /******************** I/O ********************/
@@ -42,8 +282,7 @@ void PosInt::set(int x) {
 }
 
 void PosInt::set (const PosInt& rhs) {
-  if (this != &rhs)
-    digits.assign (rhs.digits.begin(), rhs.digits.end());
+  digits = rhs.digits;
 }
 
 void PosInt::print_array(ostream& out) const {
@@ -156,7 +395,7 @@ void PosInt::rand (const PosInt& x) {
     rem.mod(x);
     max.sub(rem);
     do {
-      digits.resize(x.digits.size());
+      digits.assign(x.digits.size(), 0);
       for (int i=0; i<digits.size(); ++i)
         digits[i] = randomInt(B);
       normalize();
@@ -169,8 +408,9 @@ void PosInt::rand (const PosInt& x) {
 
 // Removes leading 0 digits
 void PosInt::normalize () {
+  const int* d = digits.data();
   int i;
-  for (i = digits.size()-1; i >= 0 && digits[i] == 0; --i);
+  for (i = digits.size()-1; i >= 0 && d[i] == 0; --i);
   if (i+1 < digits.size()) digits.resize(i+1);
 }
 
@@ -213,6 +453,7 @@ int PosInt::compare (const PosInt& x) const {
 // Computes dest += x, digit-wise
 // REQUIREMENT: dest has enough space to hold the complete sum.
 void PosInt::addArray (int* dest, const int* x, int len) {
+  STATS_KERNEL(ADD, len);
   int i;
   for (i=0; i < len; ++i)
     dest[i] += x[i];
@@ -242,6 +483,7 @@ void PosInt::add (const PosInt& x) {
 // Computes dest -= x, digit-wise
 // REQUIREMENT: dest >= x, so the difference is non-negative
 void PosInt::subArray (int* dest, const int* x, int len) {
+  STATS_KERNEL(SUB, len);
   int i = 0;
   for ( ; i < len; ++i)
     dest[i] -= x[i];
@@ -269,6 +511,178 @@ void PosInt::sub (const PosInt& x) {
   }
 }
 
+/******************** SHIFTS AND BITS ********************/
+
+// Computes dest = dest * 2^s, digit-wise, and returns the bits shifted
+// out of the top digit.
+// REQUIREMENT: B = 2^Bbits and 0 <= s < Bbits
+int PosInt::shiftLeftArray (int* dest, int len, int s) {
+  if (s == 0) return 0;
+  int carry = 0;
+  for (int i=0; i<len; ++i) {
+    int d = dest[i];
+    dest[i] = ((d << s) & (B-1)) | carry;
+    carry = d >> (Bbits - s);
+  }
+  return carry;
+}
+
+// Computes dest = dest / 2^s, digit-wise, and returns the bits shifted
+// out of the bottom digit.
+// REQUIREMENT: B = 2^Bbits and 0 <= s < Bbits
+int PosInt::shiftRightArray (int* dest, int len, int s) {
+  if (s == 0) return 0;
+  int carry = 0;
+  for (int i=len-1; i>=0; --i) {
+    int d = dest[i];
+    dest[i] = (d >> s) | carry;
+    carry = (d & ((1 << s) - 1)) << (Bbits - s);
+  }
+  return carry >> (Bbits - s);
+}
+
+// Largest k such that B * 2^k still fits in an int, so that mulDigit
+// and divDigit can work with 2^k.
+static int maxShiftDigit (int B) {
+  int k = 0;
+  while ((long long)B << (k+1) <= INT_MAX) ++k;
+  return k;
+}
+
+// this = this * 2^k
+void PosInt::shiftLeft (int k) {
+  if (k < 0) throw MPError("Negative shift");
+  if (digits.empty() || k == 0) return;
+  int len = digits.size();
+
+  if (Bbits > 0) {
+    // Move whole digits, then shift the rest in one pass
+    int q = k / Bbits;
+    digits.resize(len + q + 1, 0);
+    int* d = &digits[0];
+    if (q > 0) {
+      copy_backward(d, d + len, d + len + q);
+      fill(d, d + q, 0);
+    }
+    d[len + q] = shiftLeftArray(d + q, len, k % Bbits);
+  }
+  else {
+    // Multiply by 2^step at a time, which fits in a digit multiple
+    int step = maxShiftDigit(B);
+    int flog = 0;
+    while ((2 << flog) <= B) ++flog;
+    int total = len + k / flog + 2;
+    digits.resize(total, 0);
+    for (; k > 0; k -= step)
+      mulDigit(&digits[0], 1 << min(k, step), total);
+  }
+  normalize();
+}
+
+// this = this / 2^k
+void PosInt::shiftRight (int k) {
+  if (k < 0) throw MPError("Negative shift");
+  if (digits.empty() || k == 0) return;
+  int len = digits.size();
+
+  if (Bbits > 0) {
+    int q = k / Bbits;
+    if (q >= len) {
+      set(0);
+      return;
+    }
+    int* d = &digits[0];
+    if (q > 0) copy(d + q, d + len, d);
+    shiftRightArray(d, len - q, k % Bbits);
+    digits.resize(len - q);
+  }
+  else {
+    int step = maxShiftDigit(B);
+    for (; k > 0 && !digits.empty(); k -= step) {
+      divDigit(&digits[0], 1 << min(k, step), digits.size());
+      normalize();
+    }
+  }
+  normalize();
+}
+
+// Number of bits in the binary representation, or 0 if this is 0
+int PosInt::bitLength () const {
+  if (digits.empty()) return 0;
+  int bits = 0;
+  int top;
+  if (Bbits > 0) {
+    bits = (digits.size() - 1) * Bbits;
+    top = digits.back();
+  }
+  else {
+    // t >= B while it has more than one digit, so shifting it by
+    // at most log2(B) bits never drops it to zero
+    PosInt t(*this);
+    int step = 0;
+    while ((2 << step) <= B) ++step;
+    step = min(step, maxShiftDigit(B));
+    while (t.digits.size() > 1) {
+      t.shiftRight(step);
+      bits += step;
+    }
+    top = t.digits[0];
+  }
+  for (; top > 0; top >>= 1) ++bits;
+  return bits;
+}
+
+// Returns bit k of the binary representation
+bool PosInt::testBit (int k) const {
+  if (k < 0) return false;
+  if (Bbits > 0) {
+    int q = k / Bbits;
+    return q < digits.size() && ((digits[q] >> (k % Bbits)) & 1);
+  }
+  PosInt t(*this);
+  t.shiftRight(k);
+  return !t.isEven();
+}
+
+// Sets bit k of the binary representation to 1
+void PosInt::setBit (int k) {
+  if (k < 0) throw MPError("Negative bit index");
+  if (Bbits > 0) {
+    int q = k / Bbits;
+    if (q >= digits.size()) digits.resize(q+1, 0);
+    digits[q] |= 1 << (k % Bbits);
+  }
+  else if (!testBit(k)) {
+    PosInt bit(1);
+    bit.shiftLeft(k);
+    add(bit);
+  }
+}
+
+// Sets out to the bits of this, least-significant first. When B is
+// not a power of 2, the bits are peeled off a copy by dividing it by
+// the largest power of 2 divDigit allows, maxShiftDigit(B) bits at
+// a time.
+void PosInt::bits (vector<char>& out) const {
+  out.clear();
+  if (Bbits > 0) {
+    for (int i = 0; i < digits.size(); ++i)
+      for (int j = 0; j < Bbits; ++j)
+        out.push_back((digits[i] >> j) & 1);
+  }
+  else {
+    PosInt t(*this);
+    int step = maxShiftDigit(B);
+    while (!t.digits.empty()) {
+      int r = divDigit(&t.digits[0], 1 << step, t.digits.size());
+      t.normalize();
+      for (int j = 0; j < step; ++j)
+        out.push_back((r >> j) & 1);
+    }
+  }
+  while (!out.empty() && out.back() == 0) out.pop_back();
+}
+
 /******************** MULTIPLICATION ********************/
 
 // Computes dest = x * y, digit-wise.
@@ -278,6 +692,7 @@ void PosInt::sub (const PosInt& x) {
 void PosInt::mulArray 
   (int* dest, const int* x, int xlen, const int* y, int ylen) 
 {
+  STATS_KERNEL(MUL, xlen+ylen);
   for (int i=0; i<xlen+ylen; ++i) dest[i] = 0;
   for (int i=0; i<xlen; ++i) {
     for (int j=0; j<ylen; ++j) {
@@ -298,10 +713,17 @@ void debugArray(const int *x, int len){
 // x and y have the same length (len)
 // dest must have size (2*len) to store the result.
 void PosInt::fastMulArray (int* dest, const int* x, const int* y, int len) {
-  // base case
-  if(len == 1) {
-    mulArray(dest, x, len, y, len); 
-    return; 
+  STATS_KERNEL(FASTMUL, 2*len);
+
+  // base case: schoolbook in long long columns, which is faster than
+  // recursing (and allocating) any further
+  if (len <= FASTMUL_BASE_LEN) {
+    long long acc[2*FASTMUL_BASE_LEN];
+    for (int i = 0; i < 2*len; ++i) acc[i] = 0;
+    mulAccArray(acc, x, len, y, len, 1);
+    carryArray(acc, 2*len);
+    for (int i = 0; i < 2*len; ++i) dest[i] = acc[i];
+    return;
   }
 
   // helpful constants
@@ -325,6 +747,7 @@ void PosInt::fastMulArray (int* dest, const int* x, const int* y, int len) {
   // yDigitSum = yLow + yHigh;
   int *xDigitSum = new int[digitSumLen];
   int *yDigitSum = new int[digitSumLen];
+  STATS_HEAP(FASTMUL, sizeof(int) * (twoLenOver2 + z1Len + z2Len + 2*digitSumLen));
   // zero out extra digit before adding
   xDigitSum[digitSumLen - 1] = 0;
   yDigitSum[digitSumLen - 1] = 0;
@@ -380,8 +803,10 @@ void PosInt::mul(const PosInt& x) {
   }
 
   int* mycopy = new int[mylen];
-  for (int i=0; i<mylen; ++i) mycopy[i] = digits[i];
-  digits.resize(mylen + xlen);
+  STATS_HEAP(MUL, sizeof(int) * mylen);
+  const int* mine = digits.data();
+  for (int i=0; i<mylen; ++i) mycopy[i] = mine[i];
+  digits.assign(mylen + xlen, 0);
   mulArray(&digits[0], mycopy, mylen, &x.digits[0], xlen);
 
   normalize();
@@ -406,27 +831,192 @@ void PosInt::fastMul(const PosInt& x) {
     return;
   }
 
-  //least significant digits will be on the left
-  int inputLen = max(myLen, xLen);
-  int *myCopy = new int[inputLen];
-  int *xCopy = new int[inputLen];
+  // fastMulArray needs equal lengths, so the longer operand is cut
+  // into pieces as long as the shorter one (the last one zero-padded),
+  // and their products are added up. Padding the shorter operand
+  // instead would make a short * long product cost as much as a
+  // long * long one.
+  int shortLen = min(myLen, xLen);
+  int pieces = (max(myLen, xLen) + shortLen - 1) / shortLen;
+  int *shortCopy = new int[shortLen];
+  int *longCopy = new int[pieces * shortLen];
+  int *prod = new int[2*shortLen];
+  STATS_HEAP(FASTMUL, sizeof(int) * (pieces+3) * shortLen);
 
-  //create zero-padded input arrays
-  for (int i = 0; i < myLen; ++i) myCopy[i] = digits[i];
-  for (int i = myLen; i < inputLen; ++i) {myCopy[i] = 0;}
-  for (int i = 0; i < xLen; ++i) xCopy[i] = x.digits[i];    
-  for (int i = xLen; i < inputLen; ++i) {xCopy[i] = 0;}
+  //least significant digits will be on the left
+  const int* shortDigits = myLen <= xLen ? digits.data() : x.digits.data();
+  const int* longDigits = myLen <= xLen ? x.digits.data() : digits.data();
+  int longLen = max(myLen, xLen);
+  for (int i = 0; i < shortLen; ++i) shortCopy[i] = shortDigits[i];
+  for (int i = 0; i < longLen; ++i) longCopy[i] = longDigits[i];
+  for (int i = longLen; i < pieces * shortLen; ++i) longCopy[i] = 0;
 
   //prepare digits for result
   digits.clear();
-  digits.resize(inputLen*2);
+  digits.resize((pieces+1) * shortLen);
 
-  //call my fastMulArray function
-  fastMulArray(&digits[0], myCopy, xCopy, inputLen);
+  for (int p = 0; p < pieces; ++p) {
+    for (int i = 0; i < 2*shortLen; ++i) prod[i] = 0;
+    fastMulArray(prod, longCopy + p*shortLen, shortCopy, shortLen);
+    addArray(&digits[p*shortLen], prod, 2*shortLen);
+  }
 
   normalize();
-  delete [] myCopy;
-  delete [] xCopy;
+  delete [] shortCopy;
+  delete [] longCopy;
+  delete [] prod;
+}
+
+// this = this * x, with fastMul or the fused schoolbook loop of
+// mulAcc, whichever is faster
+void PosInt::mulBest (const PosInt& x) {
+  if (min(digits.size(), x.digits.size()) >= FASTMUL_CROSSOVER)
+    fastMul(x);
+  else {
+    const PosInt* xp = &x;
+    const PosInt* yp = this;
+    mulAcc(&xp, &yp, 1, 1, false);
+  }
+}
+
+/******************** FUSED MULTIPLY-ACCUMULATE ********************/
+
+// Computes acc += sign * x * y, column-wise, where sign is 1 or -1.
+// No carries are propagated, so each column of acc changes by at most
+// min(xlen,ylen) * (B-1)^2.
+// acc must have size (xlen+ylen).
+void PosInt::mulAccArray (long long* acc,
+  const int* x, int xlen, const int* y, int ylen, int sign)
+{
+  STATS_KERNEL(MULACC, xlen+ylen);
+  for (int i=0; i<xlen; ++i) {
+    long long xi = sign * x[i];
+    long long* col = acc + i;
+    for (int j=0; j<ylen; ++j)
+      col[j] += xi * y[j];
+  }
+}
+
+// Propagates the carries through acc, so that every column but the
+// last one is between 0 and B-1, and returns the last column.
+// A negative result means the value in acc is negative.
+long long PosInt::carryArray (long long* acc, int len) {
+  for (int i=0; i+1 < len; ++i) {
+    long long carry = acc[i] / B;
+    acc[i] -= carry * B;
+    if (acc[i] < 0) {
+      acc[i] += B;
+      --carry;
+    }
+    acc[i+1] += carry;
+  }
+  return acc[len-1];
+}
+
+// this = (keep ? this : 0) + sign * (x[0]*y[0] + ... + x[n-1]*y[n-1])
+// The products are summed in columns of long longs, and the carries
+// are only propagated when a column could otherwise overflow, and once
+// at the end. this is not changed until then, so it may alias any of
+// the operands.
+void PosInt::mulAcc (const PosInt* const* x, const PosInt* const* y, int n,
+  int sign, bool keep)
+{
+  int len = keep ? digits.size() : 0;
+  for (int i=0; i<n; ++i) {
+    if (!x[i]->isZero() && !y[i]->isZero())
+      len = max(len, int(x[i]->digits.size() + y[i]->digits.size()));
+  }
+  // room for the carries out of the sum of n+1 terms
+  for (long long terms = n+1; terms > 0; terms /= B) ++len;
+
+  vector<long long> acc(len, 0);
+  if (keep)
+    copy(digits.begin(), digits.end(), acc.begin());
+
+  const long long maxColumn = LLONG_MAX / 2;
+  const long long digitSquare = (long long)(B-1) * (B-1);
+  long long bound = B;
+  for (int i=0; i<n; ++i) {
+    int xlen = x[i]->digits.size();
+    int ylen = y[i]->digits.size();
+    if (xlen == 0 || ylen == 0) continue;
+
+    // Long products are multiplied out with fastMul, and only their
+    // digits are accumulated
+    bool fast = min(xlen, ylen) >= FASTMUL_CROSSOVER;
+    long long grow = fast ? B : min(xlen, ylen) * digitSquare;
+    if (bound > maxColumn - grow) {
+      carryArray(&acc[0], len);
+      bound = B;
+    }
+    bound += grow;
+
+    if (fast) {
+      PosInt prod(*x[i]);
+      prod.fastMul(*y[i]);
+      const int* p = prod.digits.data();
+      for (int j=0; j < prod.digits.size(); ++j) acc[j] += sign * p[j];
+    }
+    else {
+      mulAccArray(&acc[0], &x[i]->digits[0], xlen, &y[i]->digits[0], ylen,
+        sign);
+    }
+  }
+
+  if (carryArray(&acc[0], len) < 0)
+    throw MPError("Subtraction would result in negative number");
+  digits.assign(acc.begin(), acc.end());
+  normalize();
+}
+
+// this = this + x * y
+void PosInt::addmul (const PosInt& x, const PosInt& y) {
+  const PosInt* xp = &x;
+  const PosInt* yp = &y;
+  mulAcc(&xp, &yp, 1, 1, true);
+}
+
+// this = this - x * y
+void PosInt::submul (const PosInt& x, const PosInt& y) {
+  const PosInt* xp = &x;
+  const PosInt* yp = &y;
+  mulAcc(&xp, &yp, 1, -1, true);
+}
+
+// this = this * x mod n
+void PosInt::mulmod (const PosInt& x, const PosInt& n) {
+  const PosInt* xp = &x;
+  const PosInt* yp = this;
+  PosInt prod, q;
+  prod.mulAcc(&xp, &yp, 1, 1, false);
+  divrem(q, *this, prod, n);
+}
+
+// this = x[0]*y[0] + x[1]*y[1] + ... + x[n-1]*y[n-1]
+void PosInt::sumOfProducts (const PosInt* x, const PosInt* y, int n) {
+  vector<const PosInt*> xp(n), yp(n);
+  for (int i=0; i<n; ++i) {
+    xp[i] = &x[i];
+    yp[i] = &y[i];
+  }
+  mulAcc(n ? &xp[0] : NULL, n ? &yp[0] : NULL, n, 1, false);
+}
+
+PosInt& PosInt::operator= (const PosIntProduct& e) {
+  const PosInt* xp = &e.x;
+  const PosInt* yp = &e.y;
+  mulAcc(&xp, &yp, 1, 1, false);
+  return *this;
+}
+
+PosInt& PosInt::operator+= (const PosIntProduct& e) {
+  addmul(e.x, e.y);
+  return *this;
+}
+
+PosInt& PosInt::operator-= (const PosIntProduct& e) {
+  submul(e.x, e.y);
+  return *this;
 }
 
 /******************** DIVISION ********************/
@@ -434,6 +1024,7 @@ void PosInt::fastMul(const PosInt& x) {
 // Computes dest = dest * d, digit-wise
 // REQUIREMENT: dest has enough space to hold any overflow.
 void PosInt::mulDigit (int* dest, int d, int len) {
+  STATS_KERNEL(MULDIGIT, len);
   int i;
   for (i=0; i<len; ++i)
     dest[i] *= d;
@@ -449,6 +1040,7 @@ void PosInt::mulDigit (int* dest, int d, int len) {
 
 // Computes dest = dest / d, digit-wise, and returns dest % d
 int PosInt::divDigit (int* dest, int d, int len) {
+  STATS_KERNEL(DIVDIGIT, len);
   int r = 0;
   for (int i = len-1; i >= 0; --i) {
     dest[i] += B*r;
@@ -467,11 +1059,14 @@ int PosInt::divDigit (int* dest, int d, int len) {
 void PosInt::divremArray 
   (int* q, int* r, const int* x, int xlen, const int* y, int ylen)
 {
+  STATS_KERNEL(DIVREM, xlen+ylen);
+
   // Copy x into r
   for (int i=0; i<xlen; ++i) r[i] = x[i];
 
   // Create temporary array to hold a digit-multiple of y
   int* temp = new int[ylen+1];
+  STATS_HEAP(DIVREM, sizeof(int) * (ylen+1));
 
   int qind = xlen - ylen;
   int rind = xlen - 1;
@@ -521,23 +1116,36 @@ void PosInt::divrem (PosInt& q, PosInt& r, const PosInt& x, const PosInt& y) {
   }
   else if (2*y.digits.back() < B) {
     int ylen = y.digits.size();
-    int fac = 1;
-    int* scaley = new int[ylen];
-    for (int i=0; i<ylen; ++i) scaley[i] = y.digits[i];
-    do {
-      mulDigit (scaley, 2, ylen);
-      fac *= 2;
-    } while (2*scaley[ylen-1] < B);
-
     int xlen = x.digits.size()+1;
+    int* scaley = new int[ylen];
     int* scalex = new int[xlen];
+    STATS_HEAP(DIVREM, sizeof(int) * (xlen+ylen));
+    for (int i=0; i<ylen; ++i) scaley[i] = y.digits[i];
     for (int i=0; i<xlen-1; ++i) scalex[i] = x.digits[i];
     scalex[xlen-1] = 0;
-    mulDigit (scalex, fac, xlen);
-    q.digits.resize(xlen - ylen + 1);
-    r.digits.resize(xlen);
+
+    // Scale both by 2^shift, so the top digit of y is at least B/2
+    int shift = 0;
+    if (Bbits > 0) {
+      for (int top = scaley[ylen-1]; 2*top < B; top *= 2) ++shift;
+      shiftLeftArray (scaley, ylen, shift);
+      scalex[xlen-1] = shiftLeftArray (scalex, xlen-1, shift);
+    }
+    else {
+      int fac = 1;
+      do {
+        mulDigit (scaley, 2, ylen);
+        fac *= 2;
+        ++shift;
+      } while (2*scaley[ylen-1] < B);
+      mulDigit (scalex, fac, xlen);
+    }
+
+    q.digits.assign(xlen - ylen + 1, 0);
+    r.digits.assign(xlen, 0);
     divremArray (&q.digits[0], &r.digits[0], scalex, xlen, scaley, ylen);
-    divDigit (&r.digits[0], fac, xlen);
+    if (Bbits > 0) shiftRightArray (&r.digits[0], xlen, shift);
+    else divDigit (&r.digits[0], 1 << shift, xlen);
     delete [] scaley;
     delete [] scalex;
   }
@@ -548,14 +1156,16 @@ void PosInt::divrem (PosInt& q, PosInt& r, const PosInt& x, const PosInt& y) {
     int* yarr = NULL;
     if (&x == &q || &x == &r) {
       xarr = new int[xlen];
+      STATS_HEAP(DIVREM, sizeof(int) * xlen);
       for (int i=0; i<xlen; ++i) xarr[i] = x.digits[i];
     }
     if (&y == &q || &y == &r) {
       yarr = new int[ylen];
+      STATS_HEAP(DIVREM, sizeof(int) * ylen);
       for (int i=0; i<ylen; ++i) yarr[i] = y.digits[i];
     }
-    q.digits.resize(xlen - ylen + 1);
-    r.digits.resize(xlen);
+    q.digits.assign(xlen - ylen + 1, 0);
+    r.digits.assign(xlen, 0);
     divremArray (&q.digits[0], &r.digits[0], 
       (xarr == NULL ? (&x.digits[0]) : xarr), xlen, 
       (yarr == NULL ? (&y.digits[0]) : yarr), ylen);
@@ -568,10 +1178,8 @@ void PosInt::divrem (PosInt& q, PosInt& r, const PosInt& x, const PosInt& y) {
 
 /******************** EXPONENTIATION ********************/
 
-// this = this ^ x
+// this = this ^ x, by square-and-multiply over the bits of x
 void PosInt::pow (const PosInt& x) {
-  static const PosInt one(1);
-
   if (this == &x) {
     PosInt xcopy(x);
     pow(xcopy);
@@ -579,15 +1187,257 @@ void PosInt::pow (const PosInt& x) {
   }
 
   PosInt mycopy(*this);
+  vector<char> e;
+  x.bits(e);
   set(1);
-  for (PosInt i(0); i.compare(x) < 0; i.add(one)) {
-    mul(mycopy);
+  for (int i = e.size()-1; i >= 0; --i) {
+    mul(*this);
+    if (e[i]) mul(mycopy);
+  }
+}
+
+// result = a^b mod n, by square-and-multiply over the bits of b
+void PosInt::powmod (PosInt& result, const PosInt& a, const PosInt& b, const PosInt& n) {
+  SpecialModulus special(1, 1);
+  if (Bbits > 0 && SpecialModulus::detect(special, n)) {
+    powmod(result, a, b, special);
+    return;
+  }
+
+  PosInt base(a);
+  base.mod(n);
+  PosInt res(1);
+  res.mod(n);
+  vector<char> e;
+  b.bits(e);
+  for (int i = e.size()-1; i >= 0; --i) {
+    res.mulmod(res, n);
+    if (e[i]) res.mulmod(base, n);
   }
+  result.set(res);
 }
 
-// result = a^b mod n
-void powmod (PosInt& result, const PosInt& a, const PosInt& b, const PosInt& n) {
+// result = a^b mod n, reducing with n's special form
+void PosInt::powmod (PosInt& result, const PosInt& a, const PosInt& b, const SpecialModulus& n) {
+  if (!n.folds()) {
+    powmod(result, a, b, n.modulus());
+    return;
+  }
 
+  PosInt base(a);
+  n.reduce(base);
+  PosInt res(1);
+  n.reduce(res);
+  vector<char> e;
+  b.bits(e);
+  for (int i = e.size()-1; i >= 0; --i) {
+    res.mulBest(res);
+    n.reduce(res);
+    if (e[i]) {
+      res.mulBest(base);
+      n.reduce(res);
+    }
+  }
+  result.set(res);
+}
+
+/******************** PRODUCTS ********************/
+
+// Subtrees with at least this many digits in total are multiplied
+// out in their own thread.
+static const long PARALLEL_PRODUCT_LEN = 2048;
+
+// result = v[lo] * ... * v[hi-1], where size[i] is the total length of
+// v[0] ... v[i-1]. The range is split where the length is halved, so
+// that both sides of every multiplication have about the same size.
+void PosInt::productTree (PosInt& result, const PosInt* v,
+  const long* size, int lo, int hi, int depth)
+{
+  if (hi - lo == 1) {
+    result.set(v[lo]);
+    return;
+  }
+
+  long half = (size[lo] + size[hi]) / 2;
+  int mid = lo + 1;
+  while (mid + 1 < hi && size[mid+1] <= half) ++mid;
+
+  PosInt right;
+  if (depth > 0 && size[hi] - size[lo] >= PARALLEL_PRODUCT_LEN) {
+    future<void> left = async(launch::async, productTree,
+      ref(result), v, size, lo, mid, depth-1);
+    productTree(right, v, size, mid, hi, depth-1);
+    left.get();
+  }
+  else {
+    productTree(result, v, size, lo, mid, depth);
+    productTree(right, v, size, mid, hi, depth);
+  }
+
+  result.mulBest(right);
+}
+
+// this = *begin * ... * *(end-1)
+void PosInt::product (const PosInt* begin, const PosInt* end) {
+  int n = end - begin;
+  if (n <= 0) {
+    set(1);
+    return;
+  }
+
+  vector<long> size(n+1, 0);
+  for (int i=0; i<n; ++i) size[i+1] = size[i] + begin[i].digits.size();
+
+  int depth = 0;
+  for (unsigned threads = thread::hardware_concurrency(); threads > 1;
+       threads /= 2)
+    ++depth;
+
+  PosInt result;
+  productTree(result, begin, &size[0], 0, n, depth);
+  set(result);
+}
+
+// Fills primes with the primes up to n.
+static void primesUpTo (int n, vector<int>& primes) {
+  vector<bool> composite(n+1, false);
+  for (int p = 2; p <= n; ++p) {
+    if (composite[p]) continue;
+    primes.push_back(p);
+    for (long long m = (long long)p*p; m <= n; m += p) composite[m] = true;
+  }
+}
+
+// Sets result to the product of primes[i]^exps[i].
+static void primePowerProduct (PosInt& result,
+  const vector<int>& primes, const vector<int>& exps)
+{
+  vector<PosInt> factors;
+  for (int i = 0; i < primes.size(); ++i) {
+    int p = primes[i];
+    int e = exps[i];
+    if (e == 0) continue;
+
+    // p^e, by repeated squaring once it no longer fits in an int
+    long long small = 1;
+    for (; e > 0 && small <= INT_MAX / p; --e) small *= p;
+    factors.push_back(PosInt(int(small)));
+    if (e > 0) {
+      PosInt base(p);
+      PosInt& pe = factors.back();
+      PosInt power(1);
+      for (; e > 0; e /= 2) {
+        if (e % 2 == 1) power.mul(base);
+        if (e > 1) base.mul(base);
+      }
+      pe.mul(power);
+    }
+  }
+  result.product(factors.empty() ? NULL : &factors[0],
+    factors.empty() ? NULL : &factors[0] + factors.size());
+}
+
+// this = n!, as the product of p^e over the primes p <= n, where
+// e = n/p + n/p^2 + ... (Legendre's formula)
+void PosInt::factorial (int n) {
+  if (n < 0) throw MPError("Factorial of a negative number");
+  vector<int> primes;
+  primesUpTo(n, primes);
+  vector<int> exps(primes.size(), 0);
+  for (int i = 0; i < primes.size(); ++i)
+    for (long long q = primes[i]; q <= n; q *= primes[i])
+      exps[i] += n / q;
+  primePowerProduct(*this, primes, exps);
+}
+
+// this = n choose k, as the product of p^e over the primes p <= n,
+// where e is the number of borrows when subtracting k from n in base p
+// (Kummer's theorem), computed with Legendre's formula.
+void PosInt::binomial (int n, int k) {
+  if (n < 0 || k < 0) throw MPError("Binomial of a negative number");
+  if (k > n) {
+    set(0);
+    return;
+  }
+  vector<int> primes;
+  primesUpTo(n, primes);
+  vector<int> exps(primes.size(), 0);
+  for (int i = 0; i < primes.size(); ++i)
+    for (long long q = primes[i]; q <= n; q *= primes[i])
+      exps[i] += n/q - k/q - (n-k)/q;
+  primePowerProduct(*this, primes, exps);
+}
+
+/******************** SPECIAL MODULI ********************/
+
+SpecialModulus::SpecialModulus (int k, const PosInt& c) :k(k), c(c) {
+  init();
+}
+
+SpecialModulus::SpecialModulus (int k, int c) :k(k), c(c) {
+  init();
+}
+
+void SpecialModulus::init() {
+  if (k < 1) throw MPError("SpecialModulus needs k >= 1");
+  if (c.isZero() || c.bitLength() > k)
+    throw MPError("SpecialModulus needs 0 < c < 2^k");
+  m.set(1);
+  m.shiftLeft(k);
+  m.sub(c);
+  if (m.isZero()) throw MPError("SpecialModulus needs 0 < c < 2^k");
+  cdig = (c.digits.size() <= 1 && c.digits[0] <= INT_MAX / PosInt::B)
+    ? c.digits[0] : 0;
+  small = c.bitLength() <= k/2;
+}
+
+// Returns true, and sets sm, if n = 2^k - c with c at most k/2 bits long
+bool SpecialModulus::detect (SpecialModulus& sm, const PosInt& n) {
+  int k = n.bitLength();
+  if (k < 2) return false;
+  PosInt c(1);
+  c.shiftLeft(k);
+  c.sub(n);
+  if (c.bitLength() > k/2) return false;
+  sm = SpecialModulus(k, c);
+  return true;
+}
+
+// x = x mod (2^k - c), by folding the bits above 2^k back in
+// (x = hi*2^k + lo = hi*c + lo) until x < 2^k. Then x < 2m, since
+// c <= 2^(k/2), so the modulus is subtracted at most once.
+void SpecialModulus::reduce (PosInt& x) const {
+  if (!folds()) {
+    x.mod(m);
+    return;
+  }
+
+  while (x.bitLength() > k) {
+    PosInt hi(x);
+    hi.shiftRight(k);
+
+    // x = lo
+    int len = (k + PosInt::Bbits - 1) / PosInt::Bbits;
+    x.digits.resize(len);
+    int topbits = k - (len-1) * PosInt::Bbits;
+    x.digits[len-1] &= (1 << topbits) - 1;
+    x.normalize();
+
+    // x = lo + hi*c
+    if (cdig > 0) {
+      int hlen = hi.digits.size() + 3;
+      hi.digits.resize(hlen, 0);
+      PosInt::mulDigit(&hi.digits[0], cdig, hlen);
+      hi.normalize();
+    }
+    else hi.mulBest(c);
+    x.add(hi);
+  }
+  if (x.compare(m) >= 0) x.sub(m);
+}
+
+void PosInt::mod (const SpecialModulus& m) {
+  m.reduce(*this);
 }
 
 /******************** GCDs ********************/
@@ -617,3 +1467,32 @@ void PosInt::xgcd (PosInt& s, PosInt& t, const PosInt& x, const PosInt& y) {
 bool PosInt::MillerRabin () const {
   return false;
 }
+
+// returns true if this Mersenne number 2^p - 1 is prime:
+// with s = 4 and s = s^2 - 2 mod 2^p - 1 repeated p-2 times, it is
+// prime exactly when s ends up 0 (for odd prime p).
+bool PosInt::LucasLehmer () const {
+  int p = bitLength();
+  PosInt check(1);
+  check.shiftLeft(p);
+  check.sub(*this);
+  if (p == 0 || check.compare(PosInt(1)) != 0)
+    throw MPError("LucasLehmer needs a Mersenne number 2^p - 1");
+
+  if (p < 2) return false;
+  if (p == 2) return true;
+  // 2^p - 1 is composite whenever p is
+  for (int d = 2; d*d <= p; ++d)
+    if (p % d == 0) return false;
+
+  SpecialModulus mersenne(p, 1);
+  static const PosInt two(2);
+  PosInt s(4);
+  for (int i = 0; i < p-2; ++i) {
+    s.mulBest(s);
+    s.add(mersenne.modulus());
+    s.sub(two);
+    mersenne.reduce(s);
+  }
+  return s.isZero();
+}
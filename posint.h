@@ -1,6 +1,7 @@
 #ifndef POSINT_H
 #define POSINT_H
 
+#include <atomic>
 #include <iostream>
 #include <vector>
 #include <exception>
@@ -15,12 +16,127 @@ class MPError :public virtual std::exception {
       { return msg ? msg : "Unspecified MP error"; }
 };
 
+/* A snapshot of the performance counters of the digit-wise kernels.
+ * The counters are only collected when the library is compiled with
+ * -DPOSINT_STATS; otherwise the instrumentation is compiled out and
+ * every snapshot is all zeros.
+ */
+class PosIntStats {
+  public:
+    enum Kernel {
+      ADD, SUB, MUL, FASTMUL, MULACC, DIVREM, MULDIGIT, DIVDIGIT, NKERNELS
+    };
+
+    struct Counters {
+      // Number of calls, including recursive ones
+      unsigned long long calls;
+      // Total length in digits of the arrays passed in
+      unsigned long long digits;
+      // Deepest recursion seen
+      unsigned long long maxDepth;
+      // Bytes of temporary arrays allocated
+      unsigned long long heapBytes;
+      // Time spent, in CPU timestamp ticks. This includes any other
+      // kernels called, and a recursive kernel is only timed at the
+      // outermost call.
+      unsigned long long cycles;
+    };
+
+    Counters kernel[NKERNELS];
+
+    PosIntStats();
+
+    // Returns the kernel's name, e.g. "fastMulArray"
+    static const char* name (int k);
+
+    // Prints one line per kernel: name calls digits maxDepth heapBytes cycles
+    void print (std::ostream& out) const;
+};
+
+class PosIntProduct;
+template <int N> class PosIntSumOfProducts;
+template <int Bits> class FixedPosInt;
+class SpecialModulus;
+
+/* This class holds the digits of a PosInt. Once there are at least
+ * SHARE_MIN of them, they move to a reference-counted buffer that is
+ * shared by every copy of the PosInt until one of them changes it, so
+ * copying a large PosInt is O(1) and the digits are only copied when
+ * (and if) a shared copy is written to. Shorter values are just copied,
+ * which is cheaper than allocating a shared buffer for them.
+ * The interface is the part of std::vector that PosInt uses; every
+ * non-const member first makes the buffer unshared, so pointers
+ * obtained from it are only valid until the PosInt is copied.
+ * The count is atomic, so PosInts that share a buffer can be used
+ * from different threads.
+ */
+class DigitVector {
+  private:
+    static const size_t SHARE_MIN = 256;
+
+    struct Rep {
+      std::atomic<int> refs;
+      std::vector<int> v;
+      Rep() :refs(1) { }
+    };
+    std::vector<int> own;  // the digits, if rep is NULL
+    Rep* rep;              // the digits, if they are (or can be) shared
+
+    // Drops this reference to the shared buffer
+    void release();
+    // Makes the shared buffer unshared, by copying it
+    std::vector<int>& unshare();
+    // Moves the digits to a shared buffer
+    void share();
+
+    // Returns the digits, after copying them if they are shared
+    std::vector<int>& mut() { return rep ? unshare() : own; }
+    // Returns the digits, after dropping (not copying) them if shared
+    std::vector<int>& fresh() {
+      if (rep && rep->refs.load(std::memory_order_acquire) != 1) release();
+      return rep ? rep->v : own;
+    }
+    // Moves the digits to a shared buffer once there are enough
+    void settle() { if (rep == NULL && own.size() >= SHARE_MIN) share(); }
+
+  public:
+    DigitVector() :rep(NULL) { }
+    DigitVector (const DigitVector& d);
+    DigitVector (DigitVector&& d);
+    DigitVector& operator= (const DigitVector& d);
+    DigitVector& operator= (DigitVector&& d);
+    ~DigitVector() { release(); }
+
+    size_t size() const { return rep ? rep->v.size() : own.size(); }
+    bool empty() const { return size() == 0; }
+    const int* data() const { return rep ? rep->v.data() : own.data(); }
+    const int* begin() const { return data(); }
+    const int* end() const { return data() + size(); }
+
+    const int& operator[] (size_t i) const { return data()[i]; }
+    int& operator[] (size_t i) { return mut()[i]; }
+    const int& back() const { return data()[size()-1]; }
+    int& back() { return mut().back(); }
+
+    void resize (size_t n, int val = 0) { mut().resize(n, val); settle(); }
+    void assign (size_t n, int val) { fresh().assign(n, val); settle(); }
+    template <class It>
+    void assign (It first, It last) { fresh().assign(first, last); settle(); }
+    void push_back (int x) { mut().push_back(x); settle(); }
+    void clear() { fresh().clear(); }
+};
+
 /* This class represents an arbitrarily large integer
  * that is at least 0. It is represented by a vector of
  * digits, starting from the least-significant digit, and
  * with each digit between 0 and B-1.
  */
 class PosInt {
+  friend class DiskPosInt;
+  friend class SpecialModulus;
+  friend class RnsBasis;
+  template <int Bits> friend class FixedPosInt;
+
   private:
     // It must ALWAYS be the case that B = Bbase ^ Bpow.
     // B is really the one to be concerned about for arithmetic; 
@@ -28,8 +144,25 @@ class PosInt {
     static int B;
     static int Bbase;
     static int Bpow;
+    // log2(B) if B is a power of 2, and 0 otherwise
+    static int Bbits;
    
-    std::vector<int> digits;
+    DigitVector digits;
+
+    // Products with both operands at least this long are faster with
+    // fastMulArray than with the fused schoolbook loop of mulAcc.
+    // Measured with
+    //   bench --ops fastMul,addmul --min-digits 32 --max-digits 4096
+    //         --factor 1.41421
+    // in bases 2^15 and 10^4: the two are even at 64 digits, and fastMul
+    // is 1.2-1.3x faster from 181 digits on. Against a much longer
+    // operand, the fused loop stays ahead until the shorter one has
+    // about 1024 digits (by 1.25x at 256), so this is set in between.
+    static const int FASTMUL_CROSSOVER = 256;
+
+    // fastMulArray stops recursing at this length. 32 to 48 measured
+    // best; 48 also lets the len/2+1 digit sums stop at the same level.
+    static const int FASTMUL_BASE_LEN = 48;
 
     // Removes leading 0 digits
     void normalize();
@@ -48,6 +181,12 @@ class PosInt {
     // x and y must be same length
     static void fastMulArray
       (int* dest, const int* x, const int* y, int len);
+    // Computes dest = dest * 2^s, digit-wise, when B = 2^Bbits and
+    // 0 <= s < Bbits. Returns the bits shifted out of the top digit.
+    static int shiftLeftArray (int* dest, int len, int s);
+    // Computes dest = dest / 2^s, digit-wise, when B = 2^Bbits and
+    // 0 <= s < Bbits. Returns the bits shifted out of the bottom digit.
+    static int shiftRightArray (int* dest, int len, int s);
     // Computes dest = dest * d, digit-wise
     static void mulDigit (int* dest, int d, int len);
     // Computes dest = dest / d, digit-wise, and returns dest % d
@@ -55,6 +194,24 @@ class PosInt {
     // Computes division with remainder, digit-wise.
     static void divremArray 
       (int* q, int* r, const int* x, int xlen, const int* y, int ylen);
+    // Computes acc += sign * x * y, column-wise, deferring the carries
+    static void mulAccArray (long long* acc,
+      const int* x, int xlen, const int* y, int ylen, int sign);
+    // Propagates the carries through acc, and returns its top column
+    static long long carryArray (long long* acc, int len);
+
+    // this = this * x, with fastMul or mulAcc, whichever is faster
+    // for the lengths of the operands
+    void mulBest (const PosInt& x);
+
+    // this = (keep ? this : 0) + sign * (x[0]*y[0] + ... + x[n-1]*y[n-1])
+    void mulAcc (const PosInt* const* x, const PosInt* const* y, int n,
+      int sign, bool keep);
+
+    // result = v[lo] * ... * v[hi-1], splitting where the prefix sums
+    // of the digit lengths (in size) are halved
+    static void productTree (PosInt& result, const PosInt* v,
+      const long* size, int lo, int hi, int depth);
 
   public:
     // Computes division with remainder. After the call, we have
@@ -66,6 +223,10 @@ class PosInt {
     // any PosInt objects!
     static void setBase(int base, int pow=1);
 
+    // Returns the kernel counters summed over all threads, and then
+    // resets them to zero if reset is true.
+    static PosIntStats stats(bool reset=false);
+
     // Default constructor. Initializes to zero
     PosInt() { }
 
@@ -75,6 +236,11 @@ class PosInt {
     // Constructor from a char array
     explicit PosInt (const char* s) { read(s); }
 
+    // Constructors from a lazy product or sum of products
+    PosInt (const PosIntProduct& e) { *this = e; }
+    template <int N>
+    PosInt (const PosIntSumOfProducts<N>& e) { *this = e; }
+
     // I/O routines
     void print_array(std::ostream& out) const;
     void print(std::ostream& out) const;
@@ -112,6 +278,27 @@ class PosInt {
     // this = this * x, using Karatsuba's method
     void fastMul (const PosInt& x);
 
+    // this = this + x * y, without a temporary for the product
+    void addmul (const PosInt& x, const PosInt& y);
+
+    // this = this - x * y, without a temporary for the product
+    void submul (const PosInt& x, const PosInt& y);
+
+    // this = this * x mod n
+    void mulmod (const PosInt& x, const PosInt& n);
+
+    // this = x[0]*y[0] + x[1]*y[1] + ... + x[n-1]*y[n-1]
+    // The products are accumulated together and normalized only once.
+    void sumOfProducts (const PosInt* x, const PosInt* y, int n);
+
+    // Evaluate lazy expressions built with * and +, see below
+    PosInt& operator= (const PosIntProduct& e);
+    PosInt& operator+= (const PosIntProduct& e);
+    PosInt& operator-= (const PosIntProduct& e);
+    template <int N>
+    PosInt& operator= (const PosIntSumOfProducts<N>& e)
+      { mulAcc(e.x, e.y, N, 1, false); return *this; }
+
     // this = this / y
     void div (const PosInt& x)
       { PosInt temp; divrem(*this, temp, *this, x); }
@@ -120,11 +307,48 @@ class PosInt {
     void mod (const PosInt& x)
       { PosInt temp; divrem(temp, *this, *this, x); }
 
+    // this = this % m, without any division
+    void mod (const SpecialModulus& m);
+
+    // this = this * 2^k
+    void shiftLeft (int k);
+
+    // this = this / 2^k
+    void shiftRight (int k);
+
+    // Number of bits in the binary representation, or 0 if this is 0
+    int bitLength () const;
+
+    // Returns bit k of the binary representation (the one worth 2^k)
+    bool testBit (int k) const;
+
+    // Sets bit k of the binary representation to 1
+    void setBit (int k);
+
+    // Sets out to the binary representation, least-significant bit
+    // first, with bitLength() entries. Cheaper than calling testBit
+    // for every bit when B is not a power of 2.
+    void bits (std::vector<char>& out) const;
+
     // this = this ^ x
     void pow (const PosInt& x);
 
+    // this = *begin * ... * *(end-1), or 1 if the range is empty.
+    // Uses a balanced product tree, with large subtrees in parallel.
+    void product (const PosInt* begin, const PosInt* end);
+
+    // this = n!
+    void factorial (int n);
+
+    // this = n choose k, or 0 if k > n
+    void binomial (int n, int k);
+
     // result = a^b mod n
-    void powmod (PosInt& result, const PosInt& a, const PosInt& b, const PosInt& n);
+    // If n has the form 2^k - c for a small c, and the base is a
+    // power of two, the reductions are done by SpecialModulus
+    // instead of divrem.
+    static void powmod (PosInt& result, const PosInt& a, const PosInt& b, const PosInt& n);
+    static void powmod (PosInt& result, const PosInt& a, const PosInt& b, const SpecialModulus& n);
 
     // this = gcd(x,y)
     void gcd (const PosInt& x, const PosInt& y);
@@ -136,8 +360,98 @@ class PosInt {
 
     // return true/false if this is PROBABLY prime
     bool MillerRabin () const;
+
+    // return true/false if this is prime, when this is a Mersenne
+    // number 2^p - 1 (with the Lucas-Lehmer test)
+    bool LucasLehmer () const;
 };
 
+/* This class represents a modulus of the special form 2^k - c, with
+ * 0 < c < 2^k, such as the Mersenne numbers 2^p - 1 or 2^255 - 19.
+ * Reducing modulo it needs no division: writing x = hi*2^k + lo,
+ *   x = hi*c + lo  (mod 2^k - c),
+ * so the bits above 2^k are repeatedly folded back in with a shift
+ * and a multiplication by c. This is fast when c is much smaller
+ * than 2^k, and fastest when c fits in a digit multiplier.
+ * Folding needs c to be at most k/2 bits long, so that each fold
+ * removes at least k/2 bits, and a power-of-two base, so that the
+ * shifts move whole digits; otherwise reduce() uses divrem.
+ */
+class SpecialModulus {
+  private:
+    int k;
+    PosInt c;
+    int cdig;   // c, if mulDigit can multiply by it; otherwise 0
+    bool small; // c is at most k/2 bits long
+    PosInt m;   // 2^k - c
+
+    void init();
+
+  public:
+    // The modulus 2^k - c
+    SpecialModulus (int k, const PosInt& c);
+    SpecialModulus (int k, int c);
+
+    // Returns true, and sets sm, if n = 2^k - c with c at most k/2
+    // bits long; otherwise returns false.
+    static bool detect (SpecialModulus& sm, const PosInt& n);
+
+    const PosInt& modulus () const { return m; }
+    int exponent () const { return k; }
+    const PosInt& offset () const { return c; }
+
+    // true if reduce() folds instead of calling divrem
+    bool folds () const { return small && PosInt::Bbits > 0; }
+
+    // x = x mod (2^k - c)
+    void reduce (PosInt& x) const;
+};
+
+/* Lazy expressions, so that a statement like
+ *   r = a*b + c*d + e*f;
+ * makes a single fused sumOfProducts call and never materializes the
+ * products. They only hold references to their operands, so they have
+ * to be assigned to a PosInt within the statement that builds them.
+ */
+class PosIntProduct {
+  public:
+    const PosInt& x;
+    const PosInt& y;
+    PosIntProduct (const PosInt& a, const PosInt& b) :x(a), y(b) { }
+};
+
+template <int N>
+class PosIntSumOfProducts {
+  public:
+    const PosInt* x[N];
+    const PosInt* y[N];
+};
+
+inline PosIntProduct operator* (const PosInt& a, const PosInt& b)
+  { return PosIntProduct(a, b); }
+
+inline PosIntSumOfProducts<2> operator+
+  (const PosIntProduct& a, const PosIntProduct& b)
+{
+  PosIntSumOfProducts<2> sum;
+  sum.x[0] = &a.x; sum.y[0] = &a.y;
+  sum.x[1] = &b.x; sum.y[1] = &b.y;
+  return sum;
+}
+
+template <int N>
+PosIntSumOfProducts<N+1> operator+
+  (const PosIntSumOfProducts<N>& a, const PosIntProduct& b)
+{
+  PosIntSumOfProducts<N+1> sum;
+  for (int i = 0; i < N; ++i) {
+    sum.x[i] = a.x[i];
+    sum.y[i] = a.y[i];
+  }
+  sum.x[N] = &b.x; sum.y[N] = &b.y;
+  return sum;
+}
+
 std::ostream& operator<< (std::ostream& out, const PosInt& x);
 std::istream& operator>> (std::istream& out, PosInt& x);
 
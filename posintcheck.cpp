@@ -0,0 +1,248 @@
+#include <iostream>
+#include "posint.h"
+#include "rns.h"
+using namespace std;
+
+/* Regression checks for PosInt, run by make check in several bases.
+ * Each check compares a result against one computed another way.
+ * Exits with status 1 if any result is wrong.
+ */
+
+static int failures = 0;
+static int base, basePow;  // the current base is base^basePow
+
+static void check (bool ok, const char* what) {
+  if (!ok) {
+    cerr << "base " << base << "^" << basePow << ": " << what
+         << " is wrong" << endl;
+    ++failures;
+  }
+}
+
+// A random number below B^n
+static PosInt randDigits (int n) {
+  PosInt lim(base), x;
+  lim.pow(PosInt(n * basePow));
+  x.rand(lim);
+  return x;
+}
+
+/******************** DIGIT STORAGE ********************/
+
+// Copies of large values share their digits until one is written to
+static void checkSharing () {
+  PosInt a = randDigits(300);
+  a.add(PosInt(1));
+  PosInt saved;
+  saved.add(a);  // an independent copy of the value
+
+  PosInt b(a);
+  b.add(PosInt(1));
+  check(a.compare(saved) == 0, "copy-then-write (constructor)");
+  b.sub(PosInt(1));
+  check(b.compare(saved) == 0, "write to a shared copy");
+
+  PosInt c(7);
+  c = a;
+  c.mul(PosInt(3));
+  check(a.compare(saved) == 0, "copy-then-write (assignment)");
+  PosInt d(c);
+  PosInt three(saved);
+  three.mul(PosInt(3));
+  check(d.compare(three) == 0, "copy of an assigned shared value");
+
+  c = c;
+  check(c.compare(three) == 0, "self-assignment");
+}
+
+/******************** SHIFTS AND BITS ********************/
+
+// 2^k, by repeated doubling
+static PosInt powerOfTwo (int k) {
+  PosInt p(1);
+  for (int i = 0; i < k; ++i) p.add(p);
+  return p;
+}
+
+static void checkShifts () {
+  PosInt x = randDigits(40);
+  x.add(PosInt(1));
+  int ks[] = { 0, 1, 7, 15, 16, 33, 100, 257 };
+  for (int i = 0; i < 8; ++i) {
+    int k = ks[i];
+    PosInt p = powerOfTwo(k);
+
+    PosInt left(x), ref(x);
+    left.shiftLeft(k);
+    ref.mul(p);
+    check(left.compare(ref) == 0, "shiftLeft");
+
+    PosInt right(x), q, r;
+    right.shiftRight(k);
+    PosInt::divrem(q, r, x, p);
+    check(right.compare(q) == 0, "shiftRight");
+
+    check(p.bitLength() == k+1, "bitLength of 2^k");
+    p.sub(PosInt(1));
+    check(p.bitLength() == k, "bitLength of 2^k - 1");
+    check(p.isZero() || p.testBit(k-1), "testBit");
+    check(!p.testBit(k), "testBit above the top");
+
+    PosInt s;
+    s.setBit(k);
+    check(s.compare(powerOfTwo(k)) == 0, "setBit");
+  }
+
+  vector<char> b;
+  x.bits(b);
+  check(b.size() == x.bitLength(), "bits length");
+  PosInt rebuilt;
+  for (int i = b.size()-1; i >= 0; --i) {
+    rebuilt.add(rebuilt);
+    if (b[i]) rebuilt.add(PosInt(1));
+  }
+  check(rebuilt.compare(x) == 0, "bits");
+}
+
+static void checkPow () {
+  PosInt a = randDigits(3);
+  PosInt p(a), ref(1);
+  p.pow(PosInt(37));
+  for (int i = 0; i < 37; ++i) ref.mul(a);
+  check(p.compare(ref) == 0, "pow");
+
+  // a^(e+f) = a^e * a^f mod n, with large exponents
+  PosInt n = randDigits(10), e = randDigits(60), f = randDigits(50);
+  n.add(PosInt(2));
+  PosInt ae, af, aef, ef(e);
+  ef.add(f);
+  PosInt::powmod(ae, a, e, n);
+  PosInt::powmod(af, a, f, n);
+  PosInt::powmod(aef, a, ef, n);
+  ae.mulmod(af, n);
+  check(ae.compare(aef) == 0, "powmod");
+}
+
+/******************** SPECIAL MODULI ********************/
+
+// A random number below 2^bits
+static PosInt randBits (int bits) {
+  PosInt lim(1), x;
+  lim.shiftLeft(bits);
+  x.rand(lim);
+  return x;
+}
+
+// 2^p - 1
+static PosInt mersenne (int p) {
+  PosInt m(1);
+  m.shiftLeft(p);
+  m.sub(PosInt(1));
+  return m;
+}
+
+static void checkReduce (int k, const PosInt& c) {
+  SpecialModulus sm(k, c);
+  const PosInt& m = sm.modulus();
+  PosInt m1(m);
+  m1.sub(PosInt(1));
+  PosInt xs[] = { PosInt(0), m1, m, randBits(k), randBits(2*k),
+                  randBits(3*k+5) };
+  for (int i = 0; i < 6; ++i) {
+    PosInt x(xs[i]), ref(xs[i]);
+    sm.reduce(x);
+    ref.mod(m);
+    check(x.compare(ref) == 0, "SpecialModulus::reduce");
+  }
+}
+
+static void checkSpecial () {
+  checkReduce(127, PosInt(1));
+  checkReduce(255, PosInt(19));
+  checkReduce(521, PosInt(1));
+  checkReduce(200, randBits(100));  // the largest c that folds
+
+  // c too large to fold: just over k/2 bits, and close to 2^k
+  PosInt c(1);
+  c.shiftLeft(100);
+  c.add(PosInt(5));
+  checkReduce(200, c);
+  c = mersenne(200);
+  c.sub(PosInt(2));
+  checkReduce(200, c);
+
+  // Exponents of the Mersenne primes up to 607, then exponents p for
+  // which 2^p - 1 is composite, prime or not
+  int primes[] = { 2, 3, 5, 7, 13, 17, 19, 31, 61, 89, 107, 127, 521, 607 };
+  for (int i = 0; i < 14; ++i)
+    check(mersenne(primes[i]).LucasLehmer(), "LucasLehmer (prime)");
+  int composites[] = { 1, 4, 9, 11, 23, 29, 37, 67, 257 };
+  for (int i = 0; i < 9; ++i)
+    check(!mersenne(composites[i]).LucasLehmer(), "LucasLehmer (composite)");
+}
+
+/******************** RESIDUE NUMBER SYSTEM ********************/
+
+// bits is large enough that the top of the product trees has operands
+// above FASTMUL_CROSSOVER digits in every base checked
+static void checkRns (long bits) {
+  RnsBasis basis(bits);
+  const PosInt& M = basis.product();
+  check(M.bitLength() > bits, "RnsBasis product");
+
+  PosInt xs[] = { PosInt(0), PosInt(1), randBits(bits/2), randBits(bits) };
+  for (int i = 0; i < 4; ++i) {
+    RnsPosInt r(basis, xs[i]);
+    PosInt back;
+    r.get(back);
+    check(back.compare(xs[i]) == 0, "RNS round trip");
+  }
+
+  // Numbers of M or more come back reduced mod M
+  PosInt big = randBits(bits);
+  big.add(M);
+  PosInt back;
+  RnsPosInt(basis, big).get(back);
+  big.sub(M);
+  check(back.compare(big) == 0, "RNS round trip above M");
+
+  // a + b*c, and (a + b*c - a) * d, against PosInt
+  PosInt a = randBits(bits/2), b = randBits(bits/3), c = randBits(bits/3),
+    d = randBits(bits/4);
+  RnsPosInt ra(basis, a), rb(basis, b), rc(basis, c), rd(basis, d);
+  RnsPosInt r(ra);
+  r.addmul(rb, rc);
+  PosInt ref(a);
+  ref.addmul(b, c);
+  r.get(back);
+  check(back.compare(ref) == 0, "RnsPosInt::addmul");
+
+  r.sub(ra);
+  r.mul(rd);
+  ref.sub(a);
+  ref.mul(d);
+  r.get(back);
+  check(back.compare(ref) == 0, "RnsPosInt::sub and mul");
+
+  r.add(ra);
+  ref.add(a);
+  r.get(back);
+  check(back.compare(ref) == 0, "RnsPosInt::add");
+}
+
+int main () {
+  int bases[][2] = { {2, 15}, {10, 4}, {16, 3}, {6, 5}, {10, 1} };
+  for (int i = 0; i < 5; ++i) {
+    base = bases[i][0];
+    basePow = bases[i][1];
+    PosInt::setBase(base, basePow);
+    checkSharing();
+    checkShifts();
+    checkPow();
+    checkSpecial();
+    checkRns(20000);
+  }
+  if (failures > 0) return 1;
+  cout << "PosInt: all checks passed" << endl;
+  return 0;
+}
@@ -0,0 +1,103 @@
+#ifndef RNS_H
+#define RNS_H
+
+#include <stdint.h>
+#include <vector>
+#include "posint.h"
+
+/* This class is a residue number system basis: a list of distinct
+ * primes m_0, ..., m_{n-1} just below 2^31, whose product M bounds the
+ * numbers it can represent. It holds the product tree of the primes,
+ * which the conversions to and from residues walk down and up.
+ */
+class RnsBasis {
+  private:
+    std::vector<uint32_t> mods;
+    std::vector<uint32_t> invs;  // (M/m_i)^-1 mod m_i
+    std::vector<PosInt> tree;    // tree[1] = M; node v has children 2v, 2v+1
+
+    // Below this many primes, the remainder tree stops dividing and
+    // reduces modulo each prime directly. (Measured; the many small
+    // divisions cost more than the word arithmetic that replaces them.)
+    static const int LEAF_PRIMES = 32;
+
+    // x mod m
+    static uint32_t residue (const PosInt& x, uint32_t m);
+
+    void build (int v, int lo, int hi);
+    void split (uint32_t* r, int v, int lo, int hi, const PosInt& x) const;
+    void combine (PosInt& x, int v, int lo, int hi, const uint32_t* r) const;
+
+    // Not copyable: RnsPosInts point to their basis
+    RnsBasis (const RnsBasis&);
+    RnsBasis& operator= (const RnsBasis&);
+
+  public:
+    // A basis whose product M is greater than 2^bits
+    explicit RnsBasis (long bits);
+
+    // Number of primes
+    int size () const { return mods.size(); }
+
+    // The i'th prime
+    uint32_t modulus (int i) const { return mods[i]; }
+
+    // The product M of all the primes
+    const PosInt& product () const { return tree[1]; }
+
+    // Sets r[i] = x mod m_i, with a remainder tree: x is reduced
+    // modulo the product of each half of the primes, and so on down.
+    void toResidues (uint32_t* r, const PosInt& x) const;
+
+    // Sets x to the number less than M with residues r, by the
+    // Chinese remainder theorem, combining up the product tree.
+    void fromResidues (PosInt& x, const uint32_t* r) const;
+};
+
+/* This class represents a number modulo the product M of an RnsBasis,
+ * by its residues modulo each prime of the basis. Addition,
+ * subtraction and multiplication work on each residue separately,
+ * with no carries between them, so long chains of them cost linear
+ * time each; only the conversions to and from a PosInt are expensive.
+ * The results are exact as long as no true intermediate value
+ * reaches M (and, for sub, none goes negative).
+ */
+class RnsPosInt {
+  private:
+    const RnsBasis* basis;
+    std::vector<uint32_t> res;
+
+    void check (const RnsPosInt& x) const;
+
+  public:
+    // Initializes to zero
+    explicit RnsPosInt (const RnsBasis& b);
+
+    // Initializes to x mod M
+    RnsPosInt (const RnsBasis& b, const PosInt& x);
+
+    const RnsBasis& getBasis () const { return *basis; }
+
+    // The residue modulo the i'th prime of the basis
+    uint32_t residue (int i) const { return res[i]; }
+
+    // this = x mod M
+    void set (const PosInt& x);
+
+    // x = this
+    void get (PosInt& x) const;
+
+    // this = this + x mod M
+    void add (const RnsPosInt& x);
+
+    // this = this - x mod M
+    void sub (const RnsPosInt& x);
+
+    // this = this * x mod M
+    void mul (const RnsPosInt& x);
+
+    // this = this + x * y mod M
+    void addmul (const RnsPosInt& x, const RnsPosInt& y);
+};
+
+#endif // RNS_H